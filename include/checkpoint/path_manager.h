@@ -45,6 +45,8 @@ class PathManager
 
     int getCptID() const {return cptID;}
 
+    void setCptID(int id) {cptID = id;}
+
     std::string getOutputPath() const;
 
     std::string getWorkloadPath() const {return workloadPath;};
@@ -29,6 +29,14 @@ extern int profiling_state;
 extern bool checkpoint_taking;
 extern bool checkpoint_restoring;
 extern uint64_t checkpoint_interval;
+// [begin, end) of the instruction window a simpoint worker is responsible for,
+// begin is the instruction count of the waypoint it restores from
+extern uint64_t cpt_waypoint_begin;
+extern uint64_t cpt_waypoint_end;
+extern bool simpoint_bbv_binary;
+extern int simpoint_max_k;
+// extra comma separated interval sizes profiled in the same run
+extern char *simpoint_intervals;
 
 extern bool profiling_started;
 extern bool force_cpt_mmode;
@@ -42,8 +42,16 @@ class Serializer
 
     void notify_taken(uint64_t i);
 
+    bool allTaken() const;
+
   private:
 
+    uint64_t simpointStart(uint64_t simpoint_location) const {
+      return simpoint_location * intervalSize + 100000;
+    }
+
+    void keepWaypointSimpoints();
+
     uint64_t intervalSize{10 * 1000 * 1000};
 
     int cptID;
@@ -60,6 +68,10 @@ class Serializer
     std::map<uint64_t, double> simpoint2Weights;
 
     uint64_t nextUniformPoint;
+
+    // instruction count of the waypoint this worker restored from
+    uint64_t waypointBase{0};
+    bool isWaypointWorker{false};
 };
 
 extern Serializer serializer;
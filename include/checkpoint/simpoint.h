@@ -41,8 +41,10 @@
 #ifndef __CPU_SIMPLE_PROBES_SIMPOINT_HH__
 #define __CPU_SIMPLE_PROBES_SIMPOINT_HH__
 
-#include <unordered_map>
+#include <memory>
+#include <vector>
 #include <base/output.h>
+#include <checkpoint/simpoint_cluster.h>
 
 namespace SimPointNS {
 using Addr = uint64_t;
@@ -57,23 +59,68 @@ using Addr = uint64_t;
  *  - second: PC of last inst in basic block
  */
 typedef std::pair<Addr, Addr> BasicBlockRange;
-}
 
-/** Overload hash function for BasicBlockRange type */
-namespace std {
-using SimPointNS::BasicBlockRange;
-using SimPointNS::Addr;
-template<>
-struct hash<BasicBlockRange>
+/** Basic Block information */
+struct BBInfo
+{
+    /** Start and end pc */
+    BasicBlockRange range;
+    /** Unique ID */
+    uint64_t id;
+    /** Num of static insts in BB */
+    uint64_t insts;
+    /** Accumulated dynamic inst count executed by BB */
+    uint64_t count;
+};
+
+/**
+ * Open-addressing hash table of basic blocks.
+ * BBInfo lives in a dense vector indexed by (id - 1),
+ * the probing slots only hold (index + 1) so that 0 marks an empty slot.
+ */
+class BBTable
 {
   public:
-    size_t operator()(const BasicBlockRange &bb) const {
-      return hash<Addr>()(bb.first + bb.second);
+    BBTable();
+
+    /** Look up bb, insert it with a new id if it is not seen before */
+    uint32_t findOrInsert(const BasicBlockRange &bb, uint64_t insts);
+
+    BBInfo &operator[](uint32_t idx) { return entries[idx]; }
+
+    size_t size() const { return entries.size(); }
+
+  private:
+    static uint64_t hash(const BasicBlockRange &bb) {
+      uint64_t h = (bb.first ^ (bb.second << 17)) * 0x9e3779b97f4a7c15ull;
+      return h ^ (h >> 29);
     }
+
+    void grow();
+
+    std::vector<uint32_t> slots;
+    std::vector<BBInfo> entries;
+    uint64_t mask;
 };
-}
 
-namespace SimPointNS {
+/** BBV profile of one interval size, sharing the BB table with others */
+struct IntervalProfile
+{
+    /** Interval size in instructions */
+    uint64_t size;
+    /** Instruction count at the end of the current interval, 0 if not started */
+    uint64_t nextEnd;
+    /** Pointer to SimPoint BBV output stream */
+    NEMUNS::OutputStream *stream;
+    /** Suffix of output files, empty for the interval of --cpt-interval */
+    std::string suffix;
+    /** Accumulated count of each BB in the current interval, indexed by BB index */
+    std::vector<uint64_t> counts;
+    /** Index of BBs executed in the current interval */
+    std::vector<uint32_t> touched;
+    /** Online clustering of BBVs, null if not requested */
+    std::unique_ptr<SimPointCluster> cluster;
+};
 
 class SimPoint
 {
@@ -84,6 +131,9 @@ class SimPoint
 
     virtual void init();
 
+    /** Close the BBV streams and cluster the BBVs if requested */
+    void finish();
+
     /**
      * Profile basic blocks for SimPoints.
      * Called at every macro inst to increment basic block inst counts and
@@ -93,31 +143,38 @@ class SimPoint
 
     void profile_with_abs_icount(Addr pc, bool is_control, bool is_last_uop, uint64_t abs_icount);
 
+    /**
+     * Interface for blocks cached by tcache, which keeps the BB index and
+     * counter by itself and only reports them at interval boundaries.
+     */
+    uint32_t bbIndex(const BasicBlockRange &bb, uint64_t insts);
+
+    void addCount(uint32_t idx, uint64_t count);
+
+    /**
+     * Hand the counts since the last call over to every interval profile,
+     * dump those reaching their interval end, return the nearest next end.
+     */
+    uint64_t intervalEnd(uint64_t abs_icount);
+
   private:
-    uint64_t lastICount{0};
-    /** SimPoint profiling interval size in instructions */
-    uint64_t intervalSize;
+    void addProfile(uint64_t size, const std::string &suffix);
 
-    /** Inst count in current basic block */
-    uint64_t intervalCount;
-    /** Excess inst count from previous interval*/
-    uint64_t intervalDrift;
-    /** Pointer to SimPoint BBV output stream */
-    NEMUNS::OutputStream *simpointStream;
-
-    /** Basic Block information */
-    struct BBInfo
-    {
-        /** Unique ID */
-        uint64_t id;
-        /** Num of static insts in BB */
-        uint64_t insts;
-        /** Accumulated dynamic inst count executed by BB */
-        uint64_t count;
-    };
+    /** Dump the BBV of the interval and clear the counters of touched BBs */
+    void dumpInterval(IntervalProfile &p);
+
+    uint64_t lastICount{0};
+    /** Nearest interval end of all profiles */
+    uint64_t nextIntervalEnd{0};
+    /** Write BBV in the compact binary format instead of text */
+    bool binaryOutput;
 
     /** Hash table containing all previously seen basic blocks */
-    ::std::unordered_map<BasicBlockRange, BBInfo> bbMap;
+    BBTable bbMap;
+    /** Index of BBs executed since the last intervalEnd(), counts are in bbMap */
+    std::vector<uint32_t> touched;
+    /** One profile per interval size */
+    std::vector<IntervalProfile> profiles;
     /** Currently executing basic block */
     BasicBlockRange currentBBV;
     /** inst count in current basic block */
@@ -0,0 +1,77 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef NEMU_SIMPOINT_CLUSTER_H
+#define NEMU_SIMPOINT_CLUSTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace SimPointNS {
+
+/**
+ * In-tree replacement of the SimPoint 3.2 clustering stage.
+ * BBVs are randomly projected to a few dimensions as intervals complete,
+ * then k-means is run for every k in [1, maxK] in parallel and the smallest k
+ * whose BIC score reaches 90% of the observed BIC range is chosen.
+ */
+class SimPointCluster
+{
+  public:
+    explicit SimPointCluster(int max_k);
+
+    void beginInterval();
+
+    void addBB(uint64_t id, uint64_t count);
+
+    void endInterval();
+
+    /** Cluster all intervals seen so far, write simpoints0 and weights0 (with suffix) to dir */
+    void cluster(const std::string &dir, const std::string &suffix);
+
+  private:
+    struct Result
+    {
+        int k;
+        double distortion;
+        double bic;
+        std::vector<int> assign;
+        std::vector<double> centers;
+    };
+
+    static const int Dims = 15;
+    static const int Seeds = 5;
+    static const int MaxIters = 100;
+
+    /** Projection weight of (bb, dim) in [-1, 1), generated instead of stored */
+    static double projection(uint64_t id, int dim);
+
+    double dist(const double *a, const double *b) const;
+
+    Result kmeans(int k, uint64_t seed) const;
+
+    double bic(const Result &r) const;
+
+    int maxK;
+    /** Projected and normalized BBVs, Dims doubles per interval */
+    std::vector<double> points;
+    double current[Dims];
+    uint64_t currentTotal;
+};
+
+}
+
+#endif //NEMU_SIMPOINT_CLUSTER_H
@@ -29,6 +29,14 @@
 #define PMEM64 1
 #endif
 
+// states of a guest thread, which are private to the host thread
+// running it when guest threads run in parallel
+#ifdef CONFIG_USER_THREADS
+#define GUEST_THREAD_LOCAL __thread
+#else
+#define GUEST_THREAD_LOCAL
+#endif
+
 typedef MUXDEF(CONFIG_ISA64, uint64_t, uint32_t) word_t;
 typedef MUXDEF(CONFIG_ISA64, int64_t, int32_t)  sword_t;
 #define FMT_WORD MUXDEF(CONFIG_ISA64, "0x%016lx", "0x%08x")
@@ -31,6 +31,20 @@ void cpu_exec(uint64_t n);
 __attribute__((noreturn)) void longjmp_exec(int cause);
 __attribute__((noreturn)) void longjmp_exception(int ex_cause);
 
+// Exceptions of address translation for the instruction ex_return_s return
+// to its EHelper instead of longjmp(), see raise_exception().
+struct Decode;
+extern GUEST_THREAD_LOCAL struct Decode *ex_return_s;
+extern GUEST_THREAD_LOCAL bool ex_return_armed;
+void raise_exception(int ex_cause);
+
+// With CONFIG_JR_STAT, count where the targets of indirect jumps are found:
+// in the return-address stack, in the jump itself, in the side table of the
+// jump, in the target cache, or by looking up the basic blocks.
+enum { JR_STAT_RAS, JR_STAT_SITE, JR_STAT_SITE_TABLE, JR_STAT_CACHE, JR_STAT_MISS, NR_JR_STAT };
+extern uint64_t jr_stat[NR_JR_STAT];
+#define jr_stat_count(idx) IFDEF(CONFIG_JR_STAT, jr_stat[idx] ++)
+
 enum {
   SYS_STATE_UPDATE = 1,
   SYS_STATE_FLUSH_TCACHE = 2,
@@ -38,7 +52,6 @@ enum {
 void set_sys_state_flag(int flag);
 void mmu_tlb_flush(vaddr_t vaddr);
 
-struct Decode;
 void save_globals(struct Decode *s);
 void fetch_decode(struct Decode *s, vaddr_t pc);
 void lightqs_take_reg_snapshot();
@@ -61,8 +61,12 @@ typedef struct Decode {
   IFNDEF(CONFIG_PERF_OPT, void (*EHelper)(struct Decode *));
   Operand dest, src1, src2;
   vaddr_t jnpc;
+  IFDEF(CONFIG_PERF_OPT, struct Decode *rnext); // for calls, the basic block at the return address once decoded
   uint16_t idx_in_bb; // the number of instruction in the basic block, start from 1
   uint8_t type;
+  IFDEF(CONFIG_PERF_OPT, uint32_t bbv_idx);   // SimPoint BB index of the basic block ending here, 0 if not assigned
+  IFDEF(CONFIG_PERF_OPT, uint64_t bbv_count); // instructions executed by that basic block since the last BBV flush
+  IFDEF(CONFIG_PERF_OPT, struct Decode *bbv_next); // next basic block with a nonzero bbv_count, see tcache_flush_bbv()
   ISADecodeInfo isa;
   IFDEF(CONFIG_DEBUG, char logbuf[80]);
   #ifdef CONFIG_RVV
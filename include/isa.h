@@ -31,8 +31,8 @@ extern char isa_logo[];
 void init_isa();
 
 // reg
-extern CPU_state cpu;
-extern rtlreg_t csr_array[4096];
+extern GUEST_THREAD_LOCAL CPU_state cpu;
+extern GUEST_THREAD_LOCAL rtlreg_t csr_array[4096];
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
@@ -59,6 +59,9 @@ bool isa_pmp_check_permission(paddr_t addr, int len, int type, int mode);
 vaddr_t raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
 word_t isa_query_intr();
+#ifdef CONFIG_MULTIHART
+bool isa_hart_schedule();
+#endif // CONFIG_MULTIHART
 
 // difftest
   // for dut
@@ -67,6 +70,8 @@ void isa_difftest_attach();
 
   // for ref
 void isa_difftest_csrcpy(void *dut, bool direction);
+int isa_difftest_regcpy_delta(uint32_t *idx, uint64_t *val);
+int isa_difftest_csrcpy_delta(uint32_t *idx, uint64_t *val);
 #ifdef CONFIG_LIGHTQS
 void isa_difftest_regcpy(void *dut, bool direction, bool restore, uint64_t restore_count);
 void isa_difftest_uarchstatus_cpy(void *dut, bool direction, uint64_t restore_count);
@@ -80,11 +85,22 @@ void isa_difftest_guided_exec(void *guide);
 #endif
 
 void isa_difftest_query_ref(void *result_buffer, uint64_t type);
+bool isa_difftest_check_wdata(int wen, int wdest, uint64_t wdata);
+void isa_difftest_set_wdata(int wen, int wdest, uint64_t wdata);
 #ifdef CONFIG_BR_LOG
 void *isa_difftest_query_br_log(void);
 #endif // CONFIG_BR_LOG
 #ifdef CONFIG_MULTICORE_DIFF
 void isa_difftest_set_mhartid(int n);
 #endif
+#ifdef CONFIG_MULTIHART_REF
+void isa_difftest_set_nr_hart(int n);
+void isa_difftest_select_hart(int id);
+#endif // CONFIG_MULTIHART_REF
+#if defined(CONFIG_REF_SNAPSHOT) || defined(CONFIG_USER_THREADS)
+size_t isa_snapshot_size();
+void isa_snapshot_save(void *buf);
+void isa_snapshot_restore(const void *buf);
+#endif // CONFIG_REF_SNAPSHOT || CONFIG_USER_THREADS
 
 #endif
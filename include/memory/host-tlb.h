@@ -21,7 +21,12 @@
 struct Decode;
 word_t hosttlb_read(struct Decode *s, vaddr_t vaddr, int len, int type);
 void hosttlb_write(struct Decode *s, vaddr_t vaddr, int len, word_t data);
+uint8_t *hosttlb_lookup_read(vaddr_t vaddr);
+uint8_t *hosttlb_lookup_write(vaddr_t vaddr);
 void hosttlb_init();
 void hosttlb_flush(vaddr_t vaddr);
+#ifdef CONFIG_HART_CONTEXT
+void hosttlb_select(int hart);
+#endif
 
 #endif
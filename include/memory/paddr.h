@@ -25,6 +25,7 @@ extern unsigned long MEMORY_SIZE;
 #define CONFIG_MBASE 0
 #define CONFIG_MSIZE 0
 #define CONFIG_PC_RESET_OFFSET 0
+#define CONFIG_PADDRBITS 64
 #endif
 
 #define RESET_VECTOR (CONFIG_MBASE + CONFIG_PC_RESET_OFFSET)
@@ -53,20 +54,50 @@ word_t paddr_read(paddr_t addr, int len, int type, int mode, vaddr_t vaddr);
 void paddr_write(paddr_t addr, int len, word_t data, int mode, vaddr_t vaddr);
 uint8_t *get_pmem();
 
+#ifdef CONFIG_REF_SNAPSHOT
+// bitmap of pmem pages saved by the latest snapshot, NULL if there is no snapshot
+extern uint64_t *pmem_snapshot_saved;
+void pmem_snapshot_save_page(uint64_t pg);
+
+// save the pages covering [addr, addr + len) before they are written
+static inline void pmem_snapshot_hook(paddr_t addr, size_t len) {
+  if (likely(pmem_snapshot_saved == NULL)) return;
+  for (uint64_t pg = (addr - CONFIG_MBASE) >> 12; pg <= (addr + len - 1 - CONFIG_MBASE) >> 12; pg ++) {
+    if (!(pmem_snapshot_saved[pg / 64] & (1ul << (pg % 64)))) {
+      pmem_snapshot_save_page(pg);
+    }
+  }
+}
+#else
+static inline void pmem_snapshot_hook(paddr_t addr, size_t len) {}
+#endif // CONFIG_REF_SNAPSHOT
+
+#ifdef CONFIG_HART_CONTEXT
+extern int nr_hart_reservation;
+void hart_reservation_kill(paddr_t addr, size_t len);
+
+// kill the reservations of other harts covering [addr, addr + len)
+static inline void pmem_reservation_hook(paddr_t addr, size_t len) {
+  if (likely(nr_hart_reservation == 0)) return;
+  hart_reservation_kill(addr, len);
+}
+#else
+static inline void pmem_reservation_hook(paddr_t addr, size_t len) {}
+#endif // CONFIG_HART_CONTEXT
+
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
 
-#define STORE_QUEUE_SIZE 64
+#define STORE_QUEUE_SIZE CONFIG_DIFFTEST_STORE_QUEUE_SIZE
 typedef struct {
     uint64_t addr;
     uint64_t data;
     uint8_t  mask;
-    uint8_t  valid;
 } store_commit_t;
-extern store_commit_t store_commit_queue[STORE_QUEUE_SIZE];
 
 void store_commit_queue_push(uint64_t addr, uint64_t data, int len);
-store_commit_t *store_commit_queue_pop();
+int store_commit_queue_pop(store_commit_t *commit, int n);
 int check_store_commit(uint64_t *addr, uint64_t *data, uint8_t *mask);
+int store_commit_batch(uint64_t *addr, uint64_t *data, uint8_t *mask, int n);
 #endif
 
 #ifdef CONFIG_MULTICORE_DIFF
@@ -31,4 +31,9 @@ word_t vaddr_read_safe(vaddr_t addr, int len);
 
 int force_raise_pf(vaddr_t vaddr, int type);
 
+#ifdef CONFIG_MODE_USER
+// whether [addr, addr + len) is mapped by the guest with all the PROT_* bits in prot
+bool user_access_ok(vaddr_t addr, int len, int prot);
+#endif
+
 #endif
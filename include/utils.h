@@ -97,6 +97,29 @@ extern char log_asmbuf[80];
 
 word_t expr(char *e, bool *success);
 
+// ----------- selftest -----------
+
+// operands for checking host acceleration against the C versions at startup
+#define TEST_SEED 0x2545f4914f6cdd1dul
+
+static inline uint64_t test_rand(uint64_t *seed) {
+  // xorshift64
+  uint64_t x = *seed;
+  x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+  *seed = x;
+  return x;
+}
+
+static inline uint64_t test_val(int i, uint64_t *seed) {
+  uint64_t x = test_rand(seed);
+  switch (i % 4) {
+    case 0: return x;
+    case 1: return x & (x >> 29) & (x << 11); // sparse bits
+    case 2: return ~0ul >> (x % 64);
+    default: return 1ul << (x % 64);
+  }
+}
+
 // ----------- iqueue -----------
 void iqueue_commit(vaddr_t pc, uint8_t *instr_buf, uint8_t ilen);
 void iqueue_dump();
@@ -60,6 +60,32 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupported ISA
 #endif
 
+// one store committed by DUT, checked by difftest_step_batch()
+struct DifftestStore {
+  uint64_t addr;
+  uint64_t data;
+  uint8_t  mask;
+};
+
+// one committed instruction of DUT, checked by difftest_step_batch()
+// REF only steps the committed instructions, so DUT must end a batch at
+// interrupts and exceptions and raise them with the single-step API.
+struct DifftestCommit {
+  uint64_t pc;
+  uint64_t wdata;   // value written to the destination register
+  uint16_t nstore;  // number of stores committed by this instruction, taken in order from the store array
+  uint8_t  wen;     // destination register: 0 for none, 1 for gpr, 2 for fpr
+  uint8_t  wdest;
+  uint8_t  skip;    // copy wdata to the destination register instead of checking it, e.g. for MMIO loads
+};
+
+enum {
+  DIFFTEST_MISMATCH_PC    = 1,
+  DIFFTEST_MISMATCH_WDATA = 2,
+  DIFFTEST_MISMATCH_STORE = 4,
+  DIFFTEST_BATCH_END      = 8, // REF hit a trap or aborted, the rest of the batch is not run
+};
+
 #ifdef RV64_UARCH_SYNC
 struct SyncState {
   uint64_t lrscValid;
@@ -0,0 +1,75 @@
+#***************************************************************************************
+# Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+#!/bin/bash
+
+# Take simpoint checkpoints with parallel workers.
+# Phase 1 runs the workload once and takes coarse uniform "waypoint" checkpoints.
+# Phase 2 starts one worker per waypoint, which restores the waypoint and
+# fast-forwards to the simpoints falling before the next waypoint.
+
+NEMU=${NEMU:-./build/riscv64-nemu-interpreter}
+RESTORER=${RESTORER:-./resource/gcpt_restore/build/gcpt.bin}
+OUTPUT=${OUTPUT:-output_top}
+CONFIG=${CONFIG:-test}
+WORKLOAD=${WORKLOAD:-linux}
+IMG=${IMG:-./ready-to-run/linux-0xa0000.bin}
+SIMPOINT_DIR=${SIMPOINT_DIR:-simpoints}
+INTERVAL=${INTERVAL:-100000000}
+WAYPOINT_INTERVAL=${WAYPOINT_INTERVAL:-10000000000}
+JOBS=${JOBS:-`nproc`}
+
+simpoints=$SIMPOINT_DIR/$WORKLOAD/simpoints0
+if [ ! -f $simpoints ]; then
+  echo "Can not find $simpoints"
+  exit 1
+fi
+
+# stop the waypoint run right after the last simpoint
+last=`sort -n $simpoints | tail -n 1 | awk '{print $1}'`
+max_instr=$(( (last + 1) * INTERVAL + 100000 ))
+
+mkdir -p $OUTPUT
+waypoint_config=${CONFIG}_waypoints
+$NEMU -b -u --cpt-interval $WAYPOINT_INTERVAL \
+    -D $OUTPUT -C $waypoint_config -w $WORKLOAD \
+    -r $RESTORER --dont-skip-boot \
+    -I $max_instr $IMG > $OUTPUT/$waypoint_config-$WORKLOAD.log 2>&1 || exit 1
+
+# waypoint cpt file is named _<instruction count>_.gz, sort them by instruction count
+waypoints=`find $OUTPUT/$waypoint_config/$WORKLOAD -name "_*_.gz" | \
+    awk -F_ '{print $(NF-1), $0}' | sort -n`
+
+# each job is "begin end cpt", the first window starts from boot
+jobs=`echo "$waypoints" | awk -v max=$max_instr '
+  BEGIN { begin = 0; cpt = "boot" }
+  NF == 2 { print begin, $1, cpt; begin = $1; cpt = $2 }
+  END { print begin, max + 1, cpt }'`
+
+run_worker() {
+  begin=$1; end=$2; cpt=$3
+  log=$OUTPUT/$CONFIG-$WORKLOAD-$begin.log
+  if [ $cpt == "boot" ]; then
+    $NEMU -b -S $SIMPOINT_DIR --cpt-interval $INTERVAL --cpt-waypoint $begin:$end \
+        -D $OUTPUT -C $CONFIG -w $WORKLOAD -r $RESTORER --dont-skip-boot $IMG > $log 2>&1
+  else
+    $NEMU -b -c -S $SIMPOINT_DIR --cpt-interval $INTERVAL --cpt-waypoint $begin:$end \
+        -D $OUTPUT -C $CONFIG -w $WORKLOAD -r $RESTORER --dont-skip-boot $cpt > $log 2>&1
+  fi
+}
+export -f run_worker
+export NEMU RESTORER OUTPUT CONFIG WORKLOAD IMG SIMPOINT_DIR INTERVAL
+
+echo "$jobs" | xargs -P $JOBS -L 1 bash -c 'run_worker $0 $1 $2'
@@ -19,6 +19,11 @@ int profiling_state = NoProfiling;
 bool checkpoint_taking = false;
 bool checkpoint_restoring = false;
 uint64_t checkpoint_interval = 0;
+uint64_t cpt_waypoint_begin = 0;
+uint64_t cpt_waypoint_end = 0;
+bool simpoint_bbv_binary = false;
+int simpoint_max_k = 0;
+char *simpoint_intervals = NULL;
 
 bool profiling_started = false;
 bool force_cpt_mmode = false;
@@ -26,4 +31,7 @@ bool force_cpt_mmode = false;
 #ifdef CONFIG_SHARE
 // empty definition on share
 void simpoint_profiling(uint64_t pc, bool is_control, uint64_t abs_instr_count) {}
+uint32_t simpoint_bb_index(uint64_t start_pc, uint64_t end_pc, uint64_t insts) { return 0; }
+void simpoint_bb_add(uint32_t bb_index, uint64_t count) {}
+uint64_t simpoint_interval_end(uint64_t abs_instr_count) { return -1ul; }
 #endif 
\ No newline at end of file
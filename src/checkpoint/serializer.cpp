@@ -119,8 +119,12 @@ void Serializer::serializePMem(uint64_t inst_count) {
 }
 
 extern void csr_writeback();
+extern "C" void fp_host_sync();
 
 void Serializer::serializeRegs() {
+#ifdef CONFIG_FPU_SOFT_HOST
+  fp_host_sync();
+#endif
   auto *intRegCpt = (uint64_t *) (get_pmem() + IntRegStartAddr);
   for (unsigned i = 0; i < 32; i++) {
     *(intRegCpt + i) = cpu.gpr[i]._64;
@@ -226,6 +230,10 @@ void Serializer::init() {
 
       Log("Simpoint %lu: @ %lu, weight: %f", simpoint_id, simpoint_location, weight);
     }
+
+    if (cpt_waypoint_end > cpt_waypoint_begin) {
+      keepWaypointSimpoints();
+    }
   } else if (checkpoint_taking) {
     assert(checkpoint_interval);
     intervalSize = checkpoint_interval;
@@ -234,6 +242,37 @@ void Serializer::init() {
   }
 }
 
+void Serializer::keepWaypointSimpoints() {
+  // A waypoint worker restores the uniform checkpoint taken at cpt_waypoint_begin
+  // and only takes the simpoints starting in [cpt_waypoint_begin, cpt_waypoint_end).
+  // Simpoints before the window are counted so that cpt ids match a sequential run.
+  isWaypointWorker = true;
+  waypointBase = cpt_waypoint_begin;
+  int skipped = 0;
+  for (auto it = simpoint2Weights.begin(); it != simpoint2Weights.end();) {
+    uint64_t start = simpointStart(it->first);
+    if (start < cpt_waypoint_begin) {
+      skipped++;
+      it = simpoint2Weights.erase(it);
+    } else if (start >= cpt_waypoint_end) {
+      it = simpoint2Weights.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  pathManager.setCptID(skipped);
+  Log("Waypoint worker @ [%lu, %lu): %lu simpoints, first cpt id %i",
+      cpt_waypoint_begin, cpt_waypoint_end, simpoint2Weights.size(), skipped);
+  if (simpoint2Weights.empty()) {
+    Log("No simpoint falls in this waypoint window, nothing to do");
+    exit(0);
+  }
+}
+
+bool Serializer::allTaken() const {
+  return isWaypointWorker && simpoint2Weights.empty();
+}
+
 bool Serializer::shouldTakeCpt(uint64_t num_insts) {
   if ((profiling_state != SimpointCheckpointing ||
       simpoint2Weights.empty())
@@ -243,7 +282,7 @@ bool Serializer::shouldTakeCpt(uint64_t num_insts) {
   extern bool profiling_started;
 
   if (profiling_state == SimpointCheckpointing) {
-      uint64_t next_point = simpoint2Weights.begin()->first * intervalSize + 100000;
+      uint64_t next_point = simpointStart(simpoint2Weights.begin()->first) - waypointBase;
       if (num_insts >= next_point) {
           Log("Should take cpt now: %lu", num_insts);
           return true;
@@ -286,6 +325,10 @@ bool try_take_cpt(uint64_t icount) {
   if (serializer.shouldTakeCpt(icount)) {
     serializer.serialize(icount);
     serializer.notify_taken(icount);
+    if (serializer.allTaken()) {
+      Log("All simpoints of this waypoint have been taken, quit");
+      nemu_state.state = NEMU_QUIT;
+    }
     return true;
   }
   return false;
@@ -44,6 +44,8 @@
 #include <vector>
 #include <algorithm>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include "checkpoint/simpoint.h"
 #include "checkpoint/profiling.h"
 
@@ -60,36 +62,115 @@ extern FILE *log_fp;
 extern bool enable_small_log;
 }
 
+BBTable::BBTable()
+    : slots(1 << 16, 0),
+      mask((1 << 16) - 1) {
+}
+
+uint32_t
+BBTable::findOrInsert(const BasicBlockRange &bb, uint64_t insts) {
+  uint64_t i = hash(bb) & mask;
+  for (; slots[i] != 0; i = (i + 1) & mask) {
+    if (entries[slots[i] - 1].range == bb) {
+      return slots[i] - 1;
+    }
+  }
+
+  // If a new (previously unseen) basic block is found,
+  // add a new unique id and record num of insts.
+  uint32_t idx = entries.size();
+  entries.push_back(BBInfo{bb, idx + 1ul, insts, 0});
+  slots[i] = idx + 1;
+
+  // keep load factor under 1/2 so that probing sequences stay short
+  if (entries.size() * 2 > slots.size()) {
+    grow();
+  }
+  return idx;
+}
+
+void
+BBTable::grow() {
+  slots.assign(slots.size() * 2, 0);
+  mask = slots.size() - 1;
+  for (uint32_t idx = 0; idx < entries.size(); idx++) {
+    uint64_t i = hash(entries[idx].range) & mask;
+    while (slots[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = idx + 1;
+  }
+}
+
 SimPoint::SimPoint()
-    : intervalCount(0),
-      intervalDrift(0),
-      simpointStream(nullptr),
+    : binaryOutput(false),
       currentBBV(0, 0),
       currentBBVInstCount(0) {
 }
 
+// The streams are closed by simpoint_finish(), or by simout itself on other
+// exit paths, since simout may be destroyed before this object.
 SimPoint::~SimPoint() {
-  if (simpointStream)
-    NEMUNS::simout.close(simpointStream);
 }
 
 void
-SimPoint::init() {
-  simpointStream = NEMUNS::simout.create("simpoint_bbv", false);
-  if (!simpointStream)
-    xpanic("unable to open SimPoint profile_file");
+SimPoint::addProfile(uint64_t size, const std::string &suffix) {
+  auto path = pathManager.getOutputPath() + "/simpoint_bbv" + suffix +
+              (binaryOutput ? ".bin.gz" : ".gz");
+
+  using NEMUNS::simout;
+  NEMUNS::OutputStream *stream = simout.create(path, binaryOutput);
+  if (!stream)
+    xpanic("unable to open SimPoint profile_file %s\n", path.c_str());
 
+  IntervalProfile p;
+  p.size = size;
+  p.nextEnd = 0;
+  p.stream = stream;
+  p.suffix = suffix;
+  if (simpoint_max_k > 0) {
+    p.cluster = std::make_unique<SimPointCluster>(simpoint_max_k);
+  }
+  profiles.push_back(std::move(p));
+  Log("Doing simpoint profiling with interval %lu to %s", size, path.c_str());
+}
+
+void
+SimPoint::init() {
   if (profiling_state == SimpointProfiling) {
     assert(checkpoint_interval);
-    intervalSize = checkpoint_interval;
-    Log("Doing simpoint profiling with interval %lu", intervalSize);
-    auto path = pathManager.getOutputPath() + "/simpoint_bbv.gz";
+    binaryOutput = simpoint_bbv_binary;
+    addProfile(checkpoint_interval, "");
 
-    using NEMUNS::simout;
-    simpointStream = simout.create(path, false);
+    // the counting work is shared, extra interval sizes only cost the dumps
+    if (simpoint_intervals) {
+      std::stringstream ss(simpoint_intervals);
+      std::string item;
+      while (std::getline(ss, item, ',')) {
+        uint64_t size = std::stoul(item);
+        assert(size);
+        addProfile(size, "_" + std::to_string(size));
+      }
+    }
 
-    if (!simpointStream)
-      xpanic("unable to open SimPoint profile_file %s\n", path.c_str());
+    if (simpoint_max_k > 0) {
+      Log("Clustering simpoints with at most %d clusters", simpoint_max_k);
+    }
+  }
+}
+
+void
+SimPoint::finish() {
+  for (auto &p : profiles) {
+    if (p.stream) {
+      NEMUNS::simout.close(p.stream);
+      p.stream = nullptr;
+    }
+
+    if (p.cluster) {
+      p.cluster->cluster(pathManager.getOutputPath(), p.suffix);
+      p.cluster.reset();
+    }
   }
 }
 
@@ -99,6 +180,10 @@ SimPoint::profile_with_abs_icount(Addr pc, bool is_control, bool is_last_uop, ui
   // Log("0x%lx -> icount = %lu\n", pc, abs_icount);
   profile(pc, is_control, is_last_uop, exec_count);
   lastICount = abs_icount;
+
+  if (is_control && abs_icount >= nextIntervalEnd) {
+    nextIntervalEnd = intervalEnd(abs_icount);
+  }
 }
 
 void
@@ -110,60 +195,109 @@ SimPoint::profile(Addr pc, bool is_control, bool is_last_uop, unsigned instr_cou
   if (!currentBBVInstCount)
     currentBBV.first = pc;
 
-  intervalCount += instr_count;
   currentBBVInstCount += instr_count;
 
   // If inst is control inst, assume end of basic block.
   if (is_control) {
     currentBBV.second = pc;
 
-    auto map_itr = bbMap.find(currentBBV);
-    if (map_itr == bbMap.end()) {
-      // If a new (previously unseen) basic block is found,
-      // add a new unique id, record num of insts and insert into bbMap.
-      BBInfo info;
-      info.id = bbMap.size() + 1;
-      info.insts = currentBBVInstCount;
-      info.count = currentBBVInstCount;
-      bbMap.insert(::std::make_pair(currentBBV, info));
-    } else {
-      // If basic block is seen before, just increment the count by the
-      // number of insts in basic block.
-      BBInfo &info = map_itr->second;
-      info.count += currentBBVInstCount;
+    uint32_t idx = bbMap.findOrInsert(currentBBV, currentBBVInstCount);
+    if (currentBBVInstCount != 0) {
+      addCount(idx, currentBBVInstCount);
     }
     currentBBVInstCount = 0;
+  }
+}
+
+uint32_t
+SimPoint::bbIndex(const BasicBlockRange &bb, uint64_t insts) {
+  return bbMap.findOrInsert(bb, insts);
+}
+
+void
+SimPoint::addCount(uint32_t idx, uint64_t count) {
+  BBInfo &info = bbMap[idx];
+  if (info.count == 0) {
+    touched.push_back(idx);
+  }
+  info.count += count;
+}
 
-    // Reached end of interval if the sum of the current inst count
-    // (intervalCount) and the excessive inst count from the previous
-    // interval (intervalDrift) is greater than/equal to the interval size.
-    if (intervalCount + intervalDrift >= intervalSize) {
-      // summarize interval and display BBV info
-      std::vector<std::pair<uint64_t, uint64_t> > counts;
-      for (auto map_itr = bbMap.begin(); map_itr != bbMap.end();
-           ++map_itr) {
-        BBInfo &info = map_itr->second;
-        if (info.count != 0) {
-          counts.push_back(std::make_pair(info.id, info.count));
-          info.count = 0;
-        }
+uint64_t
+SimPoint::intervalEnd(uint64_t abs_icount) {
+  uint64_t next = std::numeric_limits<uint64_t>::max();
+  for (auto &p : profiles) {
+    p.counts.resize(bbMap.size(), 0);
+    for (auto idx : touched) {
+      if (p.counts[idx] == 0) {
+        p.touched.push_back(idx);
       }
-      std::sort(counts.begin(), counts.end());
-
-      // Print output BBV info
-      *simpointStream->stream() << "T";
-      for (auto cnt_itr = counts.begin(); cnt_itr != counts.end();
-           ++cnt_itr) {
-        *simpointStream->stream() << ":" << cnt_itr->first
-                                  << ":" << cnt_itr->second << " ";
+      p.counts[idx] += bbMap[idx].count;
+    }
+
+    if (p.nextEnd == 0) {
+      // profiling just started, align intervals to the absolute inst count
+      // the same as checkpoint locations computed by Serializer
+      p.nextEnd = (abs_icount / p.size + 1) * p.size;
+    } else if (abs_icount >= p.nextEnd) {
+      dumpInterval(p);
+      Log("Simpoint profilied %lu instrs for interval %lu",
+          abs_icount - (p.nextEnd - p.size), p.size);
+      // keep the excess inst count in the next interval
+      while (p.nextEnd <= abs_icount) {
+        p.nextEnd += p.size;
       }
-      *simpointStream->stream() << "\n";
-      Log("Simpoint profilied %lu instrs", intervalCount);
+    }
+    next = std::min(next, p.nextEnd);
+  }
 
-      intervalDrift = (intervalCount + intervalDrift) - intervalSize;
-      intervalCount = 0;
+  for (auto idx : touched) {
+    bbMap[idx].count = 0;
+  }
+  touched.clear();
+  return next;
+}
+
+void
+SimPoint::dumpInterval(IntervalProfile &p) {
+  // Only BBs executed in this interval are visited. Ids grow with the
+  // index, so sorting the touched list keeps the BBV sorted by id.
+  std::sort(p.touched.begin(), p.touched.end());
+
+  if (p.cluster) {
+    p.cluster->beginInterval();
+    for (auto idx : p.touched) {
+      p.cluster->addBB(bbMap[idx].id, p.counts[idx]);
+    }
+    p.cluster->endInterval();
+  }
+
+  std::ostream &os = *p.stream->stream();
+  if (binaryOutput) {
+    // Binary BBV: for each interval, a uint32_t number of entries N,
+    // then N packed pairs of (uint32_t id, uint64_t count), in host byte order
+    struct __attribute__((packed)) {
+      uint32_t id;
+      uint64_t count;
+    } entry;
+    uint32_t n = p.touched.size();
+    os.write((const char *)&n, sizeof(n));
+    for (auto idx : p.touched) {
+      entry.id = bbMap[idx].id;
+      entry.count = p.counts[idx];
+      os.write((const char *)&entry, sizeof(entry));
+      p.counts[idx] = 0;
     }
+  } else {
+    // Print output BBV info
+    os << "T";
+    for (auto idx : p.touched) {
+      os << ":" << bbMap[idx].id << ":" << p.counts[idx] << " ";
+      p.counts[idx] = 0;
+    }
+    os << "\n";
   }
+  p.touched.clear();
 }
 
 }
@@ -176,8 +310,25 @@ void simpoint_init() {
   simpoit_obj.init();
 }
 
+void simpoint_finish() {
+  simpoit_obj.finish();
+}
+
 void simpoint_profiling(uint64_t pc, bool is_control, uint64_t abs_instr_count) {
   simpoit_obj.profile_with_abs_icount(pc, is_control, true, abs_instr_count);
 }
 
+// return BB index + 1, so that 0 can mark an unassigned tcache block
+uint32_t simpoint_bb_index(uint64_t start_pc, uint64_t end_pc, uint64_t insts) {
+  return simpoit_obj.bbIndex(SimPointNS::BasicBlockRange(start_pc, end_pc), insts) + 1;
+}
+
+void simpoint_bb_add(uint32_t bb_index, uint64_t count) {
+  simpoit_obj.addCount(bb_index - 1, count);
+}
+
+uint64_t simpoint_interval_end(uint64_t abs_instr_count) {
+  return simpoit_obj.intervalEnd(abs_instr_count);
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,266 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <checkpoint/simpoint_cluster.h>
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <thread>
+
+namespace SimPointNS {
+
+extern "C" {
+#include <debug.h>
+extern bool log_enable();
+extern void log_flush();
+extern char *log_filebuf;
+extern uint64_t record_row_number;
+extern FILE *log_fp;
+extern bool enable_small_log;
+}
+
+static inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+SimPointCluster::SimPointCluster(int max_k)
+    : maxK(max_k),
+      currentTotal(0) {
+  assert(maxK > 0);
+}
+
+double
+SimPointCluster::projection(uint64_t id, int dim) {
+  uint64_t r = splitmix64(id * Dims + dim);
+  return (double)(r >> 11) / (double)(1ull << 52) - 1.0;
+}
+
+void
+SimPointCluster::beginInterval() {
+  for (int d = 0; d < Dims; d++) {
+    current[d] = 0;
+  }
+  currentTotal = 0;
+}
+
+void
+SimPointCluster::addBB(uint64_t id, uint64_t count) {
+  for (int d = 0; d < Dims; d++) {
+    current[d] += count * projection(id, d);
+  }
+  currentTotal += count;
+}
+
+void
+SimPointCluster::endInterval() {
+  // the projection is linear, so normalizing the projected vector
+  // equals projecting the normalized BBV
+  for (int d = 0; d < Dims; d++) {
+    points.push_back(currentTotal ? current[d] / currentTotal : 0);
+  }
+}
+
+double
+SimPointCluster::dist(const double *a, const double *b) const {
+  double sum = 0;
+  for (int d = 0; d < Dims; d++) {
+    double diff = a[d] - b[d];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+SimPointCluster::Result
+SimPointCluster::kmeans(int k, uint64_t seed) const {
+  size_t n = points.size() / Dims;
+  std::mt19937_64 rng(seed);
+  Result r;
+  r.k = k;
+  r.assign.assign(n, -1);
+  r.centers.resize(k * Dims);
+
+  // initialize centers with k distinct random intervals
+  std::vector<size_t> idx(n);
+  for (size_t i = 0; i < n; i++) {
+    idx[i] = i;
+  }
+  for (int c = 0; c < k; c++) {
+    std::uniform_int_distribution<size_t> pick(c, n - 1);
+    std::swap(idx[c], idx[pick(rng)]);
+    std::copy(&points[idx[c] * Dims], &points[idx[c] * Dims] + Dims, &r.centers[c * Dims]);
+  }
+
+  std::vector<size_t> size(k);
+  for (int iter = 0; iter < MaxIters; iter++) {
+    bool changed = false;
+    for (size_t i = 0; i < n; i++) {
+      int best = 0;
+      double best_dist = std::numeric_limits<double>::max();
+      for (int c = 0; c < k; c++) {
+        double d = dist(&points[i * Dims], &r.centers[c * Dims]);
+        if (d < best_dist) {
+          best_dist = d;
+          best = c;
+        }
+      }
+      if (r.assign[i] != best) {
+        r.assign[i] = best;
+        changed = true;
+      }
+    }
+    if (!changed) {
+      break;
+    }
+
+    std::fill(r.centers.begin(), r.centers.end(), 0);
+    std::fill(size.begin(), size.end(), 0);
+    for (size_t i = 0; i < n; i++) {
+      int c = r.assign[i];
+      size[c]++;
+      for (int d = 0; d < Dims; d++) {
+        r.centers[c * Dims + d] += points[i * Dims + d];
+      }
+    }
+    for (int c = 0; c < k; c++) {
+      if (size[c] == 0) {
+        // re-seed an empty cluster with a random interval
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        size_t p = pick(rng);
+        std::copy(&points[p * Dims], &points[p * Dims] + Dims, &r.centers[c * Dims]);
+        continue;
+      }
+      for (int d = 0; d < Dims; d++) {
+        r.centers[c * Dims + d] /= size[c];
+      }
+    }
+  }
+
+  r.distortion = 0;
+  for (size_t i = 0; i < n; i++) {
+    r.distortion += dist(&points[i * Dims], &r.centers[r.assign[i] * Dims]);
+  }
+  return r;
+}
+
+double
+SimPointCluster::bic(const Result &r) const {
+  // BIC of spherical gaussians sharing one variance, as in X-means and SimPoint
+  double n = points.size() / Dims;
+  int k = r.k;
+  double variance = r.distortion / (Dims * std::max(n - k, 1.0));
+  variance = std::max(variance, std::numeric_limits<double>::min());
+
+  std::vector<size_t> size(k);
+  for (int c : r.assign) {
+    size[c]++;
+  }
+  double likelihood = -n * Dims / 2 * std::log(2 * M_PI * variance) - Dims * (n - k) / 2;
+  for (int c = 0; c < k; c++) {
+    if (size[c] != 0) {
+      likelihood += size[c] * std::log(size[c] / n);
+    }
+  }
+  double params = (k - 1) + k * Dims + 1;
+  return likelihood - params / 2 * std::log(n);
+}
+
+void
+SimPointCluster::cluster(const std::string &dir, const std::string &suffix) {
+  size_t n = points.size() / Dims;
+  if (n == 0) {
+    Log("No complete interval to cluster");
+    return;
+  }
+  int max_k = std::min<size_t>(maxK, n);
+
+  // each thread takes the next k to run, keeping the best of several seeds
+  std::vector<Result> results(max_k);
+  std::atomic<int> next_k(1);
+  auto worker = [&]() {
+    int k;
+    while ((k = next_k++) <= max_k) {
+      Result best;
+      best.distortion = std::numeric_limits<double>::max();
+      for (int s = 0; s < Seeds; s++) {
+        Result r = kmeans(k, splitmix64(k * Seeds + s));
+        if (r.distortion < best.distortion) {
+          best = std::move(r);
+        }
+      }
+      best.bic = bic(best);
+      results[k - 1] = std::move(best);
+    }
+  };
+  int nr_threads = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), max_k));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nr_threads; t++) {
+    threads.emplace_back(worker);
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  double min_bic = std::numeric_limits<double>::max();
+  double max_bic = std::numeric_limits<double>::lowest();
+  for (auto &r : results) {
+    Log("Simpoint k = %d, BIC = %f", r.k, r.bic);
+    min_bic = std::min(min_bic, r.bic);
+    max_bic = std::max(max_bic, r.bic);
+  }
+  const Result *chosen = &results.back();
+  for (auto &r : results) {
+    if (r.bic >= min_bic + 0.9 * (max_bic - min_bic)) {
+      chosen = &r;
+      break;
+    }
+  }
+  Log("Simpoint clustering chooses k = %d over %lu intervals", chosen->k, n);
+
+  // the interval closest to each cluster center represents the cluster
+  std::vector<size_t> size(chosen->k);
+  std::vector<size_t> rep(chosen->k);
+  std::vector<double> rep_dist(chosen->k, std::numeric_limits<double>::max());
+  for (size_t i = 0; i < n; i++) {
+    int c = chosen->assign[i];
+    size[c]++;
+    double d = dist(&points[i * Dims], &chosen->centers[c * Dims]);
+    if (d < rep_dist[c]) {
+      rep_dist[c] = d;
+      rep[c] = i;
+    }
+  }
+
+  std::ofstream simpoints_file(dir + "/simpoints0" + suffix);
+  std::ofstream weights_file(dir + "/weights0" + suffix);
+  int id = 0;
+  for (int c = 0; c < chosen->k; c++) {
+    if (size[c] == 0) {
+      continue;
+    }
+    simpoints_file << rep[c] << " " << id << "\n";
+    weights_file << (double)size[c] / n << " " << id << "\n";
+    id++;
+  }
+  Log("Written %d simpoints to %s", id, dir.c_str());
+}
+
+}
@@ -32,18 +32,31 @@
  * You can modify this value as you want.
  */
 #define MAX_INSTR_TO_PRINT 10
-#ifndef CONFIG_SHARE
+#if defined(CONFIG_MULTIHART)
+// harts are switched between batches
+#define BATCH_SIZE CONFIG_HART_QUANTUM
+#elif !defined(CONFIG_SHARE)
 #define BATCH_SIZE 65536
 #else
 #define BATCH_SIZE 1
 #endif
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_instr = 0;
+GUEST_THREAD_LOCAL CPU_state cpu = {};
+GUEST_THREAD_LOCAL uint64_t g_nr_guest_instr = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 const rtlreg_t rzero = 0;
-rtlreg_t tmp_reg[4];
+GUEST_THREAD_LOCAL rtlreg_t tmp_reg[4];
+
+#ifdef CONFIG_USER_THREADS
+uint64_t user_threads_instr_cnt();
+void user_thread_end();
+#endif
+
+#ifdef CONFIG_FPU_SOFT_HOST
+void fp_host_enter();
+void fp_host_leave();
+#endif
 
 #ifdef CONFIG_DEBUG
 static inline void debug_hook(vaddr_t pc, const char *asmbuf) {
@@ -55,10 +68,19 @@ static inline void debug_hook(vaddr_t pc, const char *asmbuf) {
 }
 #endif
 
-static jmp_buf jbuf_exec = {};
-static uint64_t n_remain_total;
-static int n_remain;
-static Decode *prev_s;
+static GUEST_THREAD_LOCAL jmp_buf jbuf_exec = {};
+static GUEST_THREAD_LOCAL uint64_t n_remain_total;
+// With PERF_OPT, execute() only subtracts the length of every basic block
+// from its budget when leaving the block, and publishes the budget in
+// n_remain. The instructions executed in the running batch are
+// n_batch - n_remain, plus the ones before prev_s in the current block
+// after an exception. They are added to g_nr_guest_instr lazily.
+// Counting is not free: the budget is kept in a register, which longjmp()
+// discards, so the store to n_remain at every block exit stays until
+// exceptions no longer leave execute() by longjmp().
+static GUEST_THREAD_LOCAL int n_batch;
+static GUEST_THREAD_LOCAL int n_remain;
+static GUEST_THREAD_LOCAL Decode *prev_s;
 
 void save_globals(Decode *s) {
   IFDEF(CONFIG_PERF_OPT, prev_s = s);
@@ -66,22 +88,17 @@ void save_globals(Decode *s) {
 
 uint64_t get_abs_instr_count () {
 #if defined(CONFIG_ENABLE_INSTR_CNT)
-  int n_batch = n_remain_total >= BATCH_SIZE ? BATCH_SIZE : n_remain_total;
-  uint32_t n_executed = n_batch - n_remain;
-  return n_executed + g_nr_guest_instr;
+  return g_nr_guest_instr + (n_batch - n_remain);
 #endif
   return 0;
 }
 
 static void update_instr_cnt() {
 #if defined(CONFIG_ENABLE_INSTR_CNT)
-  int n_batch = n_remain_total >= BATCH_SIZE ? BATCH_SIZE : n_remain_total;
   uint32_t n_executed = n_batch - n_remain;
   n_remain_total -= (n_remain_total > n_executed) ? n_executed : n_remain_total;
   IFNDEF(CONFIG_DEBUG, g_nr_guest_instr += n_executed);
-
-  n_remain = n_batch > n_remain_total ? n_remain_total : n_batch; // clean n_remain
-  // Loge("n_remain = %i, n_remain_total = %lu\n", n_remain, n_remain_total);
+  n_batch = n_remain = 0;
 #endif
 }
 
@@ -90,23 +107,36 @@ void monitor_statistic() {
   setlocale(LC_NUMERIC, "");
   Log("host time spent = %'ld us", g_timer);
 #ifdef CONFIG_ENABLE_INSTR_CNT
-  Log("total guest instructions = %'ld", g_nr_guest_instr);
-  if (g_timer > 0) Log("simulation frequency = %'ld instr/s", g_nr_guest_instr * 1000000 / g_timer);
+  uint64_t nr_instr = MUXDEF(CONFIG_USER_THREADS, user_threads_instr_cnt(), g_nr_guest_instr);
+  Log("total guest instructions = %'ld", nr_instr);
+  if (g_timer > 0) Log("simulation frequency = %'ld instr/s", nr_instr * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
 #else
   Log("CONFIG_ENABLE_INSTR_CNT is not defined");
 #endif
+#ifdef CONFIG_JR_STAT
+  uint64_t nr_jr = 0;
+  for (int i = 0; i < NR_JR_STAT; i ++) nr_jr += jr_stat[i];
+  Log("indirect jumps = %'ld, target found in the return-address stack = %'ld, in the jump = %'ld, "
+      "in the side table of the jump = %'ld, in the target cache = %'ld, missed = %'ld", nr_jr,
+      jr_stat[JR_STAT_RAS], jr_stat[JR_STAT_SITE], jr_stat[JR_STAT_SITE_TABLE],
+      jr_stat[JR_STAT_CACHE], jr_stat[JR_STAT_MISS]);
+#endif
 }
 
-static word_t g_ex_cause = 0;
-static int g_sys_state_flag = 0;
+#ifdef CONFIG_JR_STAT
+uint64_t jr_stat[NR_JR_STAT] = {};
+#endif
+
+static GUEST_THREAD_LOCAL word_t g_ex_cause = 0;
+static GUEST_THREAD_LOCAL int g_sys_state_flag = 0;
 
 void set_sys_state_flag(int flag) {
   g_sys_state_flag |= flag;
 }
 
 void mmu_tlb_flush(vaddr_t vaddr) {
-  hosttlb_flush(vaddr);
+  IFDEF(CONFIG_MODE_SYSTEM, hosttlb_flush(vaddr));
   if (vaddr == 0) set_sys_state_flag(SYS_STATE_FLUSH_TCACHE);
 }
 
@@ -122,25 +152,49 @@ void longjmp_exception(int ex_cause) {
   cpu.guided_exec = false;
 #endif
   g_ex_cause = ex_cause;
+  ex_return_armed = false;
   Loge("longjmp_exec(NEMU_EXEC_EXCEPTION)");
   longjmp_exec(NEMU_EXEC_EXCEPTION);
 }
 
+// With PERF_OPT, the EHelpers of loads and stores with address translation
+// set ex_return_s to their Decode before the access, and the slow path of the
+// host TLB arms ex_return_armed while translating the address for it. A page
+// fault raised during that time is recorded here, ex_return_s is cleared and
+// the translation fails with MEM_RET_FAIL. The EHelper then finds ex_return_s
+// cleared and lets execute() deliver the exception in-loop.
+GUEST_THREAD_LOCAL Decode *ex_return_s = NULL;
+GUEST_THREAD_LOCAL bool ex_return_armed = false;
+
+void raise_exception(int ex_cause) {
+  if (ex_return_armed) {
+    Loge("return exception %d to pc = " FMT_WORD, ex_cause, ex_return_s->pc);
+    g_ex_cause = ex_cause;
+    ex_return_s = NULL;
+    ex_return_armed = false;
+    return;
+  }
+  longjmp_exception(ex_cause);
+}
+
 #ifdef CONFIG_PERF_OPT
 #define FILL_EXEC_TABLE(name) [concat(EXEC_ID_, name)] = &&concat(exec_, name),
 
 #define rtl_j(s, target) do { \
   IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
+  bb_end = s; \
   s = s->tnext; \
   goto end_of_bb; \
 } while (0)
 #define rtl_jr(s, target) do { \
   IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
+  bb_end = s; \
   s = jr_fetch(s, *(target)); \
   goto end_of_bb; \
 } while (0)
 #define rtl_jrelop(s, relop, src1, src2, target) do { \
   IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
+  bb_end = s; \
   if (interpret_relop(relop, *src1, *src2)) s = s->tnext; \
   else s = s->ntnext; \
   goto end_of_bb; \
@@ -157,6 +211,7 @@ void longjmp_exception(int ex_cause) {
 
 #define rtl_priv_jr(s, target) do { \
   IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
+  bb_end = s; \
   s = jr_fetch(s, *(target)); \
   if (g_sys_state_flag & SYS_STATE_FLUSH_TCACHE) { \
     s = tcache_handle_flush(s->pc); \
@@ -165,20 +220,63 @@ void longjmp_exception(int ex_cause) {
   goto end_of_loop; \
 } while (0)
 
+#define rtl_ret(s, target) do { \
+  IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb); \
+  bb_end = s; \
+  s = ret_fetch(s, *(target)); \
+  goto end_of_bb; \
+} while (0)
+#define rtl_ras_push(s) ras_push(s)
+
+#define rtl_ex_return_begin(s) (ex_return_s = (s))
+#define rtl_ex_return_end(s) do { \
+  if (unlikely(ex_return_s == NULL)) goto exception_return; \
+} while (0)
+
 static const void **g_exec_table;
 
 Decode* tcache_jr_fetch(Decode *s, vaddr_t jpc);
 Decode* tcache_decode(Decode *s);
-void tcache_handle_exception(vaddr_t jpc);
+Decode* tcache_handle_exception(vaddr_t jpc);
 Decode* tcache_handle_flush(vaddr_t snpc);
+void tcache_ret_learn(Decode *call);
 
 static inline
 Decode* jr_fetch(Decode *s, vaddr_t target) {
-  if (likely(s->tnext->pc == target)) return s->tnext;
-  if (likely(s->ntnext->pc == target)) return s->ntnext;
+  if (likely(s->tnext->pc == target)) { jr_stat_count(JR_STAT_SITE); return s->tnext; }
+  if (likely(s->ntnext->pc == target)) { jr_stat_count(JR_STAT_SITE); return s->ntnext; }
   return tcache_jr_fetch(s, target);
 }
 
+// Return-address stack of the Decode of calls. A return pops a call and takes
+// its rnext if it is at the target. Otherwise the target is fetched like other
+// indirect jumps, and rnext of the call is set if it returns to the next
+// instruction. The entries are reset by tcache_flush(), and stale ones never
+// match since ras_empty is at an invalid pc. ras_empty is shared by all
+// guest threads, so it never learns a return.
+Decode ras_empty = { .pc = (vaddr_t)-1, .snpc = (vaddr_t)-1, .rnext = &ras_empty };
+static GUEST_THREAD_LOCAL Decode *ras[CONFIG_RAS_SIZE];
+// index of the top entry, it wraps around in [0, CONFIG_RAS_SIZE)
+static GUEST_THREAD_LOCAL int ras_top = 0;
+
+void ras_flush() {
+  for (int i = 0; i < CONFIG_RAS_SIZE; i ++) ras[i] = &ras_empty;
+}
+
+static inline void ras_push(Decode *call) {
+  ras_top = (ras_top == CONFIG_RAS_SIZE - 1 ? 0 : ras_top + 1);
+  ras[ras_top] = call;
+}
+
+static inline
+Decode* ret_fetch(Decode *s, vaddr_t target) {
+  Decode *call = ras[ras_top];
+  ras_top = (ras_top == 0 ? CONFIG_RAS_SIZE - 1 : ras_top - 1);
+  if (likely(call->rnext->pc == target)) { jr_stat_count(JR_STAT_RAS); return call->rnext; }
+  if (call->snpc == target && call != &ras_empty) tcache_ret_learn(call);
+  return jr_fetch(s, target);
+}
+
 static inline void debug_difftest(Decode *_this, Decode *next) {
   IFDEF(CONFIG_IQUEUE, iqueue_commit(_this->pc, (void *)&_this->isa.instr.val, _this->snpc - _this->pc));
   IFDEF(CONFIG_DEBUG, debug_hook(_this->pc, _this->logbuf));
@@ -187,10 +285,51 @@ static inline void debug_difftest(Decode *_this, Decode *next) {
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, next->pc));
 }
 
-uint64_t per_bb_profile(Decode *s) {
+uint32_t simpoint_bb_index(uint64_t start_pc, uint64_t end_pc, uint64_t insts);
+uint64_t simpoint_interval_end(uint64_t abs_instr_count);
+void tcache_flush_bbv();
+extern GUEST_THREAD_LOCAL Decode *bbv_list;
+static uint64_t simpoint_next_interval = 0;
+// instructions executed before exceptions in the middle of basic blocks,
+// counted with the next basic block
+static GUEST_THREAD_LOCAL uint32_t simpoint_partial = 0;
+
+static inline void simpoint_profile_exception(Decode *s) {
+  if (profiling_state == SimpointProfiling && profiling_started) {
+    simpoint_partial += s->idx_in_bb - 1;
+  }
+}
+
+// The SimPoint BB index and counter live in the Decode of the last instruction
+// of the basic block, so counting is an addition and only new blocks go to the profiler.
+// Counters are handed over at interval boundaries and tcache flush, only for
+// the blocks in bbv_list, which are the ones counted since the last handover.
+static inline void simpoint_profile_bb(Decode *bb_end, uint64_t abs_inst_count) {
+  if (bb_end != NULL) {
+    uint32_t count = bb_end->idx_in_bb + simpoint_partial;
+    simpoint_partial = 0;
+    if (unlikely(bb_end->bbv_idx == 0)) {
+      Decode *bb_start = bb_end - (bb_end->idx_in_bb - 1);
+      bb_end->bbv_idx = simpoint_bb_index(bb_start->pc, bb_end->pc, bb_end->idx_in_bb);
+    }
+    if (bb_end->bbv_count == 0) {
+      bb_end->bbv_next = bbv_list;
+      bbv_list = bb_end;
+    }
+    bb_end->bbv_count += count;
+  }
+  if (unlikely(abs_inst_count >= simpoint_next_interval)) {
+    tcache_flush_bbv();
+    simpoint_next_interval = simpoint_interval_end(abs_inst_count);
+  }
+}
+
+uint64_t per_bb_profile(Decode *bb_end, Decode *s) {
+  // the profiler and the checkpoints run floating point code on the host FPU
+  IFDEF(CONFIG_FPU_SOFT_HOST, fp_host_leave());
   uint64_t abs_inst_count = get_abs_instr_count();
   if (profiling_state == SimpointProfiling && profiling_started) {
-    simpoint_profiling(s->pc, true, abs_inst_count);
+    simpoint_profile_bb(bb_end, abs_inst_count);
   }
 
   extern bool able_to_take_cpt();
@@ -204,6 +343,7 @@ uint64_t per_bb_profile(Decode *s) {
       Log("Should take checkpoint on pc 0x%lx", s->pc);
     }
   }
+  IFDEF(CONFIG_FPU_SOFT_HOST, fp_host_enter());
   return abs_inst_count;
 }
 
@@ -212,7 +352,7 @@ static int execute(int n) {
   static const void* local_exec_table[TOTAL_INSTR] = {
     MAP(INSTR_LIST, FILL_EXEC_TABLE)
   };
-  static int init_flag = 0;
+  static GUEST_THREAD_LOCAL int init_flag = 0;
   Decode *s = prev_s;
 
   if (likely(init_flag == 0)) {
@@ -224,6 +364,7 @@ static int execute(int n) {
   }
 
   __attribute__((unused)) Decode *this_s = NULL;
+  Decode *bb_end = NULL;
   while (true) {
 #if defined(CONFIG_DEBUG) || defined(CONFIG_DIFFTEST) || defined(CONFIG_IQUEUE)
     this_s = s;
@@ -246,14 +387,27 @@ def_EHelper(nemu_decode) {
   continue;
 }
 
+exception_return: __attribute__((unused));
+    // s raised an exception, count the instructions before it in the current basic block
+    IFDEF(CONFIG_ENABLE_INSTR_CNT, n -= s->idx_in_bb - 1; n_remain = n);
+    IFNDEF(CONFIG_ENABLE_INSTR_CNT, n --);
+    if (unlikely(profiling_started)) simpoint_profile_exception(s);
+    cpu.pc = raise_intr(g_ex_cause, s->pc);
+    cpu.amo = false; // clean up
+    s = tcache_handle_exception(cpu.pc);
+    if (unlikely(n <= 0)) return n;
+    continue;
+
 end_of_bb:
+    // the only per-block cost of counting, see n_remain
     IFDEF(CONFIG_ENABLE_INSTR_CNT, n_remain = n);
     IFNDEF(CONFIG_ENABLE_INSTR_CNT, n --);
 
-    // Here is per bb action
-    uint64_t abs_inst_count = per_bb_profile(s);
+    // Here is per bb action, which needs the instruction count only when profiling
+    if (unlikely(profiling_started)) per_bb_profile(bb_end, s);
+    bb_end = NULL;
     Logtb("prev pc = 0x%lx, pc = 0x%lx", prev_s->pc, s->pc);
-    Logtb("Executed %ld instructions in total, pc: 0x%lx\n", (int64_t) abs_inst_count, prev_s->pc);
+    Logtb("Executed %ld instructions in total, pc: 0x%lx\n", (int64_t) get_abs_instr_count(), prev_s->pc);
 
     if (unlikely(n <= 0)) break;
 
@@ -268,7 +422,7 @@ end_of_loop:
   // Here is per loop action and some priv instruction action
   Loge("end_of_loop: prev pc = 0x%lx, pc = 0x%lx, total insts: %lu, remain: %lu",
        prev_s->pc, s->pc, get_abs_instr_count(), n_remain_total);
-  per_bb_profile(s);
+  if (unlikely(profiling_started)) per_bb_profile(bb_end, s);
 
   debug_difftest(this_s, s);
   prev_s = s;
@@ -279,6 +433,10 @@ end_of_loop:
 
 #define rtl_priv_next(s)
 #define rtl_priv_jr(s, target) rtl_jr(s, target)
+#define rtl_ret(s, target) rtl_jr(s, target)
+#define rtl_ras_push(s) do { } while (0)
+#define rtl_ex_return_begin(s)
+#define rtl_ex_return_end(s)
 
 #include "isa-exec.h"
 static const void* g_exec_table[TOTAL_INSTR] = {
@@ -438,7 +596,7 @@ uint64_t lightqs_restore_reg_snapshot(uint64_t n) {
 #endif // CONFIG_LIGHTQS
 
 static int execute(int n) {
-  static Decode s;
+  static GUEST_THREAD_LOCAL Decode s;
   prev_s = &s;
   for (;n > 0; n --) {
 #ifdef CONFIG_LIGHTQS_DEBUG
@@ -527,9 +685,11 @@ void cpu_exec(uint64_t n) {
   Loge("cpu_exec will exec %lu instrunctions", n_remain_total);
   int cause;
   if ((cause = setjmp(jbuf_exec))) {
-    n_remain -= prev_s->idx_in_bb - 1;
     // Here is exception handle
 #ifdef CONFIG_PERF_OPT
+    // count the instructions before prev_s in the current basic block
+    n_remain -= prev_s->idx_in_bb - 1;
+    simpoint_profile_exception(prev_s);
     update_global();
 #endif
     Loge("After update_global, n_remain: %i, n_remain_total: %li", n_remain, n_remain_total);
@@ -537,11 +697,20 @@ void cpu_exec(uint64_t n) {
 
   while (nemu_state.state == NEMU_RUNNING &&
       MUXDEF(CONFIG_ENABLE_INSTR_CNT, n_remain_total > 0, true)) {
+    // merge the exception flags of the last batch, which may end with longjmp()
+    IFDEF(CONFIG_FPU_SOFT_HOST, fp_host_leave());
 #ifdef CONFIG_DEVICE
     extern void device_update();
     device_update();
 #endif
 
+#ifdef CONFIG_MULTIHART
+    if (cause == 0 && isa_hart_schedule()) {
+      // the next hart runs from its own pc in its own tcache
+      IFDEF(CONFIG_PERF_OPT, tcache_handle_exception(cpu.pc));
+    }
+#endif // CONFIG_MULTIHART
+
 #ifndef CONFIG_SHARE
 #ifdef LIGHTQS
     extern void pmem_record_reset();
@@ -569,14 +738,17 @@ void cpu_exec(uint64_t n) {
       }
     }
 
-    int n_batch = n_remain_total >= BATCH_SIZE ? BATCH_SIZE : n_remain_total;
-    n_remain = execute(n_batch);
+    int batch = n_remain_total >= BATCH_SIZE ? BATCH_SIZE : n_remain_total;
+    IFDEF(CONFIG_FPU_SOFT_HOST, fp_host_enter());
 #ifdef CONFIG_PERF_OPT
+    n_batch = n_remain = batch;
+    n_remain = execute(batch);
     // return from execute
     update_global(cpu.pc);
     Loge("n_remain_total: %lu", n_remain_total);
 #else
-    n_remain_total -= n_batch;
+    execute(batch);
+    n_remain_total -= batch;
 
 
 #endif
@@ -599,6 +771,13 @@ void cpu_exec(uint64_t n) {
 #endif // CONFIG_LIGHTQS
 #endif // CONFIG_SHARE
 
+  IFDEF(CONFIG_FPU_SOFT_HOST, fp_host_leave());
+
+#ifdef CONFIG_USER_THREADS
+  // the program is ended by this thread or another one
+  if (nemu_state.state != NEMU_RUNNING) user_thread_end();
+#endif
+
   // If nemu_state.state is NEMU_RUNNING, n_remain_total should be zero.
   if (nemu_state.state == NEMU_RUNNING) {
     nemu_state.state = NEMU_QUIT;
@@ -49,6 +49,10 @@ static void nemu_large_memcpy(void *dest, void *src, size_t n) {
 #endif
 
 void difftest_memcpy(paddr_t nemu_addr, void *dut_buf, size_t n, bool direction) {
+  if (direction == DIFFTEST_TO_REF && n > 0) {
+    pmem_snapshot_hook(nemu_addr, n);
+    pmem_reservation_hook(nemu_addr, n);
+  }
 #ifdef CONFIG_LARGE_COPY
   if (direction == DIFFTEST_TO_REF) nemu_large_memcpy(guest_to_host(nemu_addr), dut_buf, n);
   else nemu_large_memcpy(dut_buf, guest_to_host(nemu_addr), n);
@@ -98,6 +102,18 @@ void difftest_csrcpy(void *dut, bool direction) {
   isa_difftest_csrcpy(dut, direction);
 }
 
+// Copy the registers changed since the last sync to DUT as (idx, val) pairs,
+// idx is the word index in the layout of difftest_regcpy(), or the CSR address
+// for difftest_csrcpy_delta(). Return the number of pairs. The first call after
+// init returns everything. DUT must provide DIFFTEST_REG_SIZE / 8 or 4096 entries.
+int difftest_regcpy_delta(uint32_t *idx, uint64_t *val) {
+  return isa_difftest_regcpy_delta(idx, val);
+}
+
+int difftest_csrcpy_delta(uint32_t *idx, uint64_t *val) {
+  return isa_difftest_csrcpy_delta(idx, val);
+}
+
 void difftest_uarchstatus_sync(void *dut) {
   isa_difftest_uarchstatus_cpy(dut, DIFFTEST_TO_REF);
 }
@@ -119,11 +135,90 @@ int difftest_store_commit(uint64_t *saddr, uint64_t *sdata, uint8_t *smask) {
   return 0;
 #endif
 }
+
+// pop at most n committed stores into the arrays in one call, return the number popped,
+// or -1 if the queue is empty and stores have been dropped because the queue was full
+int difftest_store_commit_batch(uint64_t *saddr, uint64_t *sdata, uint8_t *smask, int n) {
+#ifdef CONFIG_DIFFTEST_STORE_COMMIT
+  return store_commit_batch(saddr, sdata, smask, n);
+#else
+  return 0;
+#endif
+}
 #endif
 
 void difftest_exec(uint64_t n) {
   cpu_exec(n);
 }
+
+#ifdef CONFIG_DIFFTEST_STORE_COMMIT
+// Check the stores committed by REF for one instruction against the nstore
+// stores of DUT. The mismatched store of DUT is overwritten by the one of REF,
+// or gets mask 0 if REF committed fewer stores.
+static bool check_store_batch(struct DifftestStore *store, int nstore) {
+  store_commit_t commit;
+  for (int i = 0; i < nstore; i ++) {
+    if (store_commit_queue_pop(&commit, 1) == 0) {
+      store[i].mask = 0;
+      return false;
+    }
+    if (store[i].addr - store[i].addr % 8 != commit.addr || store[i].data != commit.data ||
+        store[i].mask != commit.mask) {
+      store[i].addr = commit.addr;
+      store[i].data = commit.data;
+      store[i].mask = commit.mask;
+      return false;
+    }
+  }
+  // REF committed more stores
+  return store_commit_queue_pop(&commit, 1) == 0;
+}
+#endif
+
+// Execute and check n committed instructions of DUT in one call. The stores of
+// the commits are in store, nstore of them for each commit.
+// Return the index of the first mismatched commit with the DIFFTEST_MISMATCH_* reasons
+// in *mismatch, or n if all of them match. REF stops right after the mismatched
+// instruction (or before it, for a pc mismatch), so DUT may regcpy to report it.
+// If REF hits a trap or aborts, DIFFTEST_BATCH_END is also set in *mismatch, and
+// the number of commits run is returned if the last one matches.
+int difftest_step_batch(const struct DifftestCommit *commit, int n, struct DifftestStore *store, int *mismatch) {
+  for (int i = 0; i < n; i ++) {
+    const struct DifftestCommit *c = &commit[i];
+    int reason = 0;
+    if (nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT) {
+      *mismatch = DIFFTEST_BATCH_END;
+      return i;
+    }
+    if (cpu.pc != c->pc) {
+      *mismatch = DIFFTEST_MISMATCH_PC;
+      return i;
+    }
+
+    cpu_exec(1);
+
+    if (c->wen != 0) {
+      if (c->skip) isa_difftest_set_wdata(c->wen, c->wdest, c->wdata);
+      else if (!isa_difftest_check_wdata(c->wen, c->wdest, c->wdata)) reason |= DIFFTEST_MISMATCH_WDATA;
+    }
+
+#ifdef CONFIG_DIFFTEST_STORE_COMMIT
+    if (!check_store_batch(store, c->nstore)) reason |= DIFFTEST_MISMATCH_STORE;
+#endif
+    store += c->nstore;
+
+    if (nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT) {
+      *mismatch = reason | DIFFTEST_BATCH_END;
+      return reason != 0 ? i : i + 1;
+    }
+    if (reason != 0) {
+      *mismatch = reason;
+      return i;
+    }
+  }
+  *mismatch = 0;
+  return n;
+}
 #ifdef CONFIG_LIGHTQS
 void difftest_guided_exec(void * guide, uint64_t restore_count) {
 #ifdef CONFIG_LIGHTQS_DEBUG
@@ -170,6 +265,26 @@ void difftest_raise_intr(word_t NO) {
 }
 #endif // CONFIG_LIGHTQS
 
+#ifdef CONFIG_REF_SNAPSHOT
+int ref_snapshot_take();
+bool ref_snapshot_restore(int id);
+bool ref_snapshot_free(int id);
+
+// return the id of the new snapshot
+int difftest_snapshot() {
+  return ref_snapshot_take();
+}
+
+// rewind to a snapshot, newer snapshots are dropped, return 0 on success
+int difftest_restore(int id) {
+  return ref_snapshot_restore(id) ? 0 : 1;
+}
+
+int difftest_snapshot_free(int id) {
+  return ref_snapshot_free(id) ? 0 : 1;
+}
+#endif // CONFIG_REF_SNAPSHOT
+
 void difftest_enable_debug() {
 #ifdef CONFIG_SHARE
   dynamic_config.debug_difftest = true;
@@ -220,3 +335,15 @@ void difftest_put_gmaddr(uint8_t* ptr) {
 }
 
 #endif
+
+#ifdef CONFIG_MULTIHART_REF
+// should be called after difftest_init(), all harts start from the reset state
+void difftest_set_nr_hart(int n) {
+  isa_difftest_set_nr_hart(n);
+}
+
+// following calls operate on the selected hart
+void difftest_select_hart(int id) {
+  isa_difftest_select_hart(id);
+}
+#endif // CONFIG_MULTIHART_REF
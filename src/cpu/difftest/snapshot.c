@@ -0,0 +1,190 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// In-memory snapshots of the REF, which the DUT can rewind to.
+//
+// Registers, CSRs and device registers are copied when a snapshot is taken.
+// Memory is copy-on-write by pages: a page is saved into the latest snapshot
+// on its first write after that snapshot, so snapshot i holds the pages first
+// written between snapshot i and snapshot i+1, as they were at snapshot i.
+// Rewinding to snapshot i copies back the pages of the newer snapshots, newest first.
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/map.h>
+#include <stdlib.h>
+
+#ifdef CONFIG_REF_SNAPSHOT
+
+typedef struct {
+  int id;
+  uint64_t *saved;  // bitmap of pages saved in this snapshot
+  uint64_t nr_page, max_page;
+  uint64_t *page;
+  uint8_t **data;
+  void *isa;
+  uint8_t *io;
+  size_t io_size;
+  uint64_t nr_guest_instr;
+} Snapshot;
+
+uint64_t *pmem_snapshot_saved = NULL;
+
+static Snapshot *snapshots = NULL; // ordered from the oldest to the latest
+static int nr_snapshot = 0, max_snapshot = 0;
+static int next_id = 0;
+
+extern uint64_t g_nr_guest_instr;
+
+static inline uint64_t saved_words() {
+  return ((MEMORY_SIZE >> PAGE_SHIFT) + 63) / 64;
+}
+
+static inline bool page_saved(Snapshot *s, uint64_t pg) {
+  return s->saved[pg / 64] & (1ul << (pg % 64));
+}
+
+static void add_page(Snapshot *s, uint64_t pg, uint8_t *data) {
+  if (s->nr_page == s->max_page) {
+    s->max_page = s->max_page ? s->max_page * 2 : 64;
+    s->page = realloc(s->page, sizeof(s->page[0]) * s->max_page);
+    s->data = realloc(s->data, sizeof(s->data[0]) * s->max_page);
+    assert(s->page && s->data);
+  }
+  s->page[s->nr_page] = pg;
+  s->data[s->nr_page] = data;
+  s->nr_page ++;
+  s->saved[pg / 64] |= 1ul << (pg % 64);
+}
+
+static void drop_pages(Snapshot *s) {
+  for (uint64_t i = 0; i < s->nr_page; i ++) {
+    free(s->data[i]);
+  }
+  s->nr_page = 0;
+  memset(s->saved, 0, sizeof(s->saved[0]) * saved_words());
+}
+
+static void free_snapshot(Snapshot *s) {
+  drop_pages(s);
+  free(s->saved);
+  free(s->page);
+  free(s->data);
+  free(s->isa);
+  free(s->io);
+}
+
+static int find_snapshot(int id) {
+  for (int i = 0; i < nr_snapshot; i ++) {
+    if (snapshots[i].id == id) return i;
+  }
+  return -1;
+}
+
+void pmem_snapshot_save_page(uint64_t pg) {
+  assert(nr_snapshot > 0);
+  uint8_t *data = malloc(PAGE_SIZE);
+  assert(data);
+  memcpy(data, guest_to_host(CONFIG_MBASE + (pg << PAGE_SHIFT)), PAGE_SIZE);
+  add_page(&snapshots[nr_snapshot - 1], pg, data);
+}
+
+int ref_snapshot_take() {
+  if (nr_snapshot == max_snapshot) {
+    max_snapshot = max_snapshot ? max_snapshot * 2 : 8;
+    snapshots = realloc(snapshots, sizeof(snapshots[0]) * max_snapshot);
+    assert(snapshots);
+  }
+  Snapshot *s = &snapshots[nr_snapshot ++];
+  memset(s, 0, sizeof(*s));
+  s->id = next_id ++;
+  s->saved = calloc(saved_words(), sizeof(s->saved[0]));
+  assert(s->saved);
+
+  s->isa = malloc(isa_snapshot_size());
+  assert(s->isa);
+  isa_snapshot_save(s->isa);
+
+#ifdef CONFIG_DEVICE
+  uint8_t *io = get_io_space(&s->io_size);
+  s->io = malloc(s->io_size);
+  assert(s->io || s->io_size == 0);
+  memcpy(s->io, io, s->io_size);
+#endif
+
+  s->nr_guest_instr = g_nr_guest_instr;
+
+  pmem_snapshot_saved = s->saved;
+  return s->id;
+}
+
+bool ref_snapshot_restore(int id) {
+  int i = find_snapshot(id);
+  if (i == -1) return false;
+
+  // newer snapshots hold older contents of their pages, copy them back newest first
+  for (int j = nr_snapshot - 1; j >= i; j --) {
+    Snapshot *s = &snapshots[j];
+    for (uint64_t k = 0; k < s->nr_page; k ++) {
+      memcpy(guest_to_host(CONFIG_MBASE + (s->page[k] << PAGE_SHIFT)), s->data[k], PAGE_SIZE);
+    }
+    if (j > i) free_snapshot(s);
+  }
+  nr_snapshot = i + 1;
+
+  // memory equals snapshot i now, it can be rewound to again
+  Snapshot *s = &snapshots[i];
+  drop_pages(s);
+  pmem_snapshot_saved = s->saved;
+
+  isa_snapshot_restore(s->isa);
+#ifdef CONFIG_DEVICE
+  size_t io_size;
+  uint8_t *io = get_io_space(&io_size);
+  assert(io_size == s->io_size);
+  memcpy(io, s->io, io_size);
+#endif
+  g_nr_guest_instr = s->nr_guest_instr;
+
+  // code and page tables may be changed by the rewound pages
+  mmu_tlb_flush(0);
+  return true;
+}
+
+bool ref_snapshot_free(int id) {
+  int i = find_snapshot(id);
+  if (i == -1) return false;
+
+  Snapshot *s = &snapshots[i];
+  if (i > 0) {
+    // the previous snapshot needs these pages if it did not save them itself
+    Snapshot *prev = &snapshots[i - 1];
+    for (uint64_t k = 0; k < s->nr_page; k ++) {
+      if (page_saved(prev, s->page[k])) free(s->data[k]);
+      else add_page(prev, s->page[k], s->data[k]);
+    }
+    s->nr_page = 0;
+  }
+  free_snapshot(s);
+
+  memmove(&snapshots[i], &snapshots[i + 1], sizeof(snapshots[0]) * (nr_snapshot - i - 1));
+  nr_snapshot --;
+  pmem_snapshot_saved = nr_snapshot ? snapshots[nr_snapshot - 1].saved : NULL;
+  return true;
+}
+
+#endif // CONFIG_REF_SNAPSHOT
@@ -15,6 +15,8 @@
 
 #include <cpu/decode.h>
 #include <cpu/cpu.h>
+#include <checkpoint/profiling.h>
+#include <stdlib.h>
 
 #ifdef CONFIG_PERF_OPT
 
@@ -28,18 +30,64 @@ typedef struct bb_t {
 
 enum { BB_RECORD_TYPE_NTAKEN = 1, BB_RECORD_TYPE_TAKEN };
 
-static Decode tcache_pool[CONFIG_TCACHE_SIZE] = {};
-static int tc_idx = 0;
-static Decode tcache_bb_pool[TCACHE_BB_SIZE] = {};
-static Decode *tcache_bb_freelist = NULL;
-static bb_t bb_pool[CONFIG_BB_POOL_SIZE] = {};
-static int bb_idx = 0;
-static bb_t bb_list [CONFIG_BB_LIST_SIZE] = {};
+// Targets of indirect jumps which miss both entries of the jump, see jr_fetch().
+// Only decoded basic blocks are entered, so the entries are valid until tcache_flush().
+typedef struct {
+  vaddr_t pc;
+  Decode *s;
+} jr_target_t;
+// More recent targets of the indirect jump site, indexed by its Decode in tcache_pool
+// and probed before jr_target_cache. The most recently entered target is first.
+typedef struct {
+  Decode *site;
+  jr_target_t way[CONFIG_JR_SITE_WAYS];
+} jr_site_t;
+
+typedef struct {
+  Decode pool[CONFIG_TCACHE_SIZE];
+  int idx;
+  Decode record_pool[TCACHE_BB_SIZE];
+  Decode *record_freelist;
+  bb_t bb_pool[CONFIG_BB_POOL_SIZE];
+  int bb_idx;
+  bb_t bb_list[CONFIG_BB_LIST_SIZE];
+  jr_target_t jr_cache[CONFIG_JR_TARGET_CACHE_SIZE];
+  jr_site_t jr_sites[CONFIG_JR_SITE_TABLE_SIZE];
+} TCache;
+
+#ifdef CONFIG_HART_CONTEXT
+// every hart has its own tcache, tc points to the one of the selected hart
+static TCache tcache0 = {};
+static TCache *tc = &tcache0;
+static TCache **hart_tcache = NULL;
+static int nr_hart_tcache = 0;
+#else
+// every guest thread has its own tcache
+static GUEST_THREAD_LOCAL TCache tcache0 = {};
+#define tc (&tcache0)
+#endif // CONFIG_HART_CONTEXT
+
+#define tcache_pool        (tc->pool)
+#define tc_idx             (tc->idx)
+#define tcache_bb_pool     (tc->record_pool)
+#define tcache_bb_freelist (tc->record_freelist)
+#define bb_pool            (tc->bb_pool)
+#define bb_idx             (tc->bb_idx)
+#define bb_list            (tc->bb_list)
+#define jr_target_cache    (tc->jr_cache)
+#define jr_site_table      (tc->jr_sites)
+
 static const void *g_exec_nemu_decode;
 
+extern Decode ras_empty;
+void ras_flush();
+
 static inline Decode* tcache_entry_init(Decode *s, vaddr_t pc) {
   s->tnext = s->ntnext = NULL;
+  s->rnext = &ras_empty;
   s->type = 0;
+  s->bbv_idx = 0;
+  s->bbv_count = 0;
   s->pc = pc;
   s->EHelper = g_exec_nemu_decode;
   return s;
@@ -132,23 +180,47 @@ static bb_t* bb_find(vaddr_t pc) {
   } while (1);
 }
 
-static void tcache_bb_fetch(Decode *_this, int is_taken, vaddr_t jpc) {
+// return whether the basic block at jpc is already decoded
+static bool tcache_bb_fetch(Decode *_this, int is_taken, vaddr_t jpc) {
   bb_t* bb = bb_find(jpc);
   if (bb != NULL) {
     if (is_taken) { _this->tnext = bb->s; }
     else { _this->ntnext = bb->s; }
+    return true;
   } else {
     Decode *ret = tcache_bb_new(jpc);
     if (is_taken) { ret->type = BB_RECORD_TYPE_TAKEN; _this->tnext = ret; }
     else { ret->type = BB_RECORD_TYPE_NTAKEN; _this->ntnext = ret; }
     ret->bb_src = _this;
+    return false;
   }
 }
 
+void simpoint_bb_add(uint32_t bb_index, uint64_t count);
+
+// basic blocks with nonzero counters, linked by bbv_next
+GUEST_THREAD_LOCAL Decode *bbv_list = NULL;
+
+// hand the per-block counters over to the SimPoint profiler
+void tcache_flush_bbv() {
+  for (Decode *s = bbv_list; s != NULL; s = s->bbv_next) {
+    simpoint_bb_add(s->bbv_idx, s->bbv_count);
+    s->bbv_count = 0;
+  }
+  bbv_list = NULL;
+}
+
 void tcache_flush() {
+  if (profiling_state == SimpointProfiling && profiling_started) tcache_flush_bbv();
+  bbv_list = NULL;
+  // the Decode may be reused by an instruction without ex_return support
+  ex_return_s = NULL;
   tc_idx = 0;
   bb_idx = 0;
   memset(bb_list, -1, sizeof(bb_list));
+  memset(jr_target_cache, -1, sizeof(jr_target_cache));
+  memset(jr_site_table, -1, sizeof(jr_site_table));
+  ras_flush();
 
   int i;
   for (i = 0; i < TCACHE_BB_SIZE - 1; i ++) {
@@ -159,16 +231,52 @@ void tcache_flush() {
 }
 
 enum { TCACHE_BB_BUILDING, TCACHE_RUNNING };
-static int tcache_state = TCACHE_RUNNING;
-static Decode *bb_now = NULL, *bb_now_record = NULL;
+static GUEST_THREAD_LOCAL int tcache_state = TCACHE_RUNNING;
+static GUEST_THREAD_LOCAL Decode *bb_now = NULL, *bb_now_record = NULL;
+
+static inline void jr_site_insert(jr_site_t *site, Decode *s, vaddr_t jpc, Decode *target) {
+  if (site->site != s) {
+    memset(site->way, -1, sizeof(site->way));
+    site->site = s;
+  }
+  memmove(&site->way[1], &site->way[0], sizeof(site->way) - sizeof(site->way[0]));
+  site->way[0].pc = jpc;
+  site->way[0].s = target;
+}
 
 __attribute__((noinline))
 Decode* tcache_jr_fetch(Decode *s, vaddr_t jpc) {
   s->ntnext = s->tnext;
-  tcache_bb_fetch(s, true, jpc);
+  jr_site_t *site = &jr_site_table[(s - tcache_pool) % CONFIG_JR_SITE_TABLE_SIZE];
+  if (site->site == s) {
+    for (int i = 0; i < CONFIG_JR_SITE_WAYS; i ++) {
+      if (site->way[i].pc == jpc) {
+        jr_stat_count(JR_STAT_SITE_TABLE);
+        s->tnext = site->way[i].s;
+        return s->tnext;
+      }
+    }
+  }
+  jr_target_t *e = &jr_target_cache[(jpc / CONFIG_ILEN_MIN) % CONFIG_JR_TARGET_CACHE_SIZE];
+  if (likely(e->pc == jpc)) {
+    jr_stat_count(JR_STAT_CACHE);
+    s->tnext = e->s;
+  } else {
+    jr_stat_count(JR_STAT_MISS);
+    if (!tcache_bb_fetch(s, true, jpc)) return s->tnext;
+    e->pc = jpc;
+    e->s = s->tnext;
+  }
+  jr_site_insert(site, s, jpc, s->tnext);
   return s->tnext;
 }
 
+// called by a return to the next instruction of the call, see ret_fetch()
+void tcache_ret_learn(Decode *call) {
+  bb_t *bb = bb_find(call->snpc);
+  if (bb != NULL) call->rnext = bb->s;
+}
+
 static inline void tcache_patch_and_free(Decode *bb_record, Decode *bb) {
   Decode *src = bb_record->bb_src;
   if (bb_record->type == BB_RECORD_TYPE_TAKEN)  { src->tnext = bb; }
@@ -178,7 +286,7 @@ static inline void tcache_patch_and_free(Decode *bb_record, Decode *bb) {
 
 __attribute__((noinline))
 Decode* tcache_decode(Decode *s) {
-  static int idx_in_bb = 0;
+  static GUEST_THREAD_LOCAL int idx_in_bb = 0;
   vaddr_t thispc = s->pc;
 
   if (tcache_state == TCACHE_RUNNING) {  // start of a basic block
@@ -239,18 +347,18 @@ full:
   longjmp_exec(NEMU_EXEC_AGAIN);
 }
 
-static Decode ex = {};
+static GUEST_THREAD_LOCAL Decode ex = {};
 
-void tcache_handle_exception(vaddr_t jpc) {
+Decode* tcache_handle_exception(vaddr_t jpc) {
   tcache_bb_fetch(&ex, true, jpc);
   save_globals(ex.tnext);
   tcache_state = TCACHE_RUNNING;
+  return ex.tnext;
 }
 
 Decode* tcache_handle_flush(vaddr_t snpc) {
   tcache_flush();
-  tcache_handle_exception(snpc);
-  return ex.tnext;
+  return tcache_handle_exception(snpc);
 }
 
 Decode* tcache_init(const void *exec_nemu_decode, vaddr_t reset_vector) {
@@ -258,4 +366,22 @@ Decode* tcache_init(const void *exec_nemu_decode, vaddr_t reset_vector) {
   g_exec_nemu_decode = exec_nemu_decode;
   return tcache_bb_new(reset_vector);
 }
+
+#ifdef CONFIG_HART_CONTEXT
+void tcache_select(int hart) {
+  if (hart >= nr_hart_tcache) {
+    hart_tcache = realloc(hart_tcache, sizeof(hart_tcache[0]) * (hart + 1));
+    assert(hart_tcache);
+    for (int i = nr_hart_tcache; i <= hart; i ++) {
+      hart_tcache[i] = (i == 0 ? &tcache0 : malloc(sizeof(TCache)));
+      assert(hart_tcache[i]);
+      if (i > 0) { tc = hart_tcache[i]; tcache_flush(); }
+    }
+    nr_hart_tcache = hart + 1;
+  }
+  tc = hart_tcache[hart];
+  // the calls in the return-address stack are in the tcache of the last hart
+  ras_flush();
+}
+#endif // CONFIG_HART_CONTEXT
 #endif
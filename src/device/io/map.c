@@ -33,6 +33,12 @@ uint8_t* new_space(int size) {
   return p;
 }
 
+// all device registers live in io_space, so this is the whole device state
+uint8_t* get_io_space(size_t *size) {
+  *size = p_space - io_space;
+  return io_space;
+}
+
 static inline void check_bound(IOMap *map, paddr_t addr) {
   Assert(map != NULL && addr <= map->high && addr >= map->low,
       "address (" FMT_PADDR ") is out of bound {%s} [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
@@ -38,6 +38,205 @@ static inline float64_t rtlToF64(rtlreg_t r) {
 uint32_t isa_fp_get_rm(Decode *s);
 void isa_fp_set_ex(uint32_t ex);
 void isa_fp_csr_check();
+
+#ifdef CONFIG_FPU_SOFT_HOST
+// Common operations run on host FPU, and their exception flags are left
+// in host FPU until fp_host_sync() merges them into fflags.
+#include <math.h>
+#include <fenv.h>
+
+static GUEST_THREAD_LOCAL int host_rm = FE_TONEAREST;
+// cleared by fp_host_selftest() if host FPU does not match softfloat
+static bool fp_host_enabled = true;
+
+static inline void host_set_rm(int rm) {
+  if (unlikely(rm != host_rm)) {
+    fesetround(rm);
+    host_rm = rm;
+  }
+}
+
+static inline bool f32_boxed(rtlreg_t r) {
+  return (r & BOX_MASK) == BOX_MASK;
+}
+
+// Return false if the operation should be done by softfloat, i.e. with RMM,
+// NaN or unboxed operands, since host FPU does not propagate them the RISC-V way.
+static bool fp_host_call(rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2,
+    uint32_t op, uint32_t w, uint32_t rm) {
+  static const int host_rm_table[] = {
+    [FPCALL_RM_RNE] = FE_TONEAREST, [FPCALL_RM_RTZ] = FE_TOWARDZERO,
+    [FPCALL_RM_RDN] = FE_DOWNWARD,  [FPCALL_RM_RUP] = FE_UPWARD,
+  };
+  if (rm == FPCALL_RM_RMM) return false;
+  bool has_src2 = (op != FPCALL_SQRT);
+  bool has_src3 = (op == FPCALL_MADD);
+
+  if (w == FPCALL_W32) {
+    if (!f32_boxed(*src1) || isNaNF32UI((uint32_t)*src1)) return false;
+    if (has_src2 && (!f32_boxed(*src2) || isNaNF32UI((uint32_t)*src2))) return false;
+    if (has_src3 && (!f32_boxed(*dest) || isNaNF32UI((uint32_t)*dest))) return false;
+    host_set_rm(host_rm_table[rm]);
+    // volatile keeps the operation after fesetround()
+    volatile union { uint32_t v; float f; } a = { .v = *src1 }, b = { .v = *src2 }, c = { .v = *dest }, r;
+    switch (op) {
+      case FPCALL_ADD:  r.f = a.f + b.f; break;
+      case FPCALL_SUB:  r.f = a.f - b.f; break;
+      case FPCALL_MUL:  r.f = a.f * b.f; break;
+      case FPCALL_DIV:  r.f = a.f / b.f; break;
+      case FPCALL_SQRT: r.f = sqrtf(a.f); break;
+      case FPCALL_MADD: r.f = fmaf(a.f, b.f, c.f); break;
+      default: return false;
+    }
+    *dest = isNaNF32UI(r.v) ? defaultNaNF32UI : (BOX_MASK | r.v);
+    return true;
+  } else if (w == FPCALL_W64) {
+    if (isNaNF64UI(*src1)) return false;
+    if (has_src2 && isNaNF64UI(*src2)) return false;
+    if (has_src3 && isNaNF64UI(*dest)) return false;
+    host_set_rm(host_rm_table[rm]);
+    volatile union { uint64_t v; double f; } a = { .v = *src1 }, b = { .v = *src2 }, c = { .v = *dest }, r;
+    switch (op) {
+      case FPCALL_ADD:  r.f = a.f + b.f; break;
+      case FPCALL_SUB:  r.f = a.f - b.f; break;
+      case FPCALL_MUL:  r.f = a.f * b.f; break;
+      case FPCALL_DIV:  r.f = a.f / b.f; break;
+      case FPCALL_SQRT: r.f = sqrt(a.f); break;
+      case FPCALL_MADD: r.f = fma(a.f, b.f, c.f); break;
+      default: return false;
+    }
+    *dest = isNaNF64UI(r.v) ? defaultNaNF64UI : r.v;
+    return true;
+  }
+  return false;
+}
+
+static inline uint32_t host_get_exception(int host_ex) {
+  uint32_t ex = 0;
+  if (host_ex & FE_INEXACT  ) ex |= FPCALL_EX_NX;
+  if (host_ex & FE_UNDERFLOW) ex |= FPCALL_EX_UF;
+  if (host_ex & FE_OVERFLOW ) ex |= FPCALL_EX_OF;
+  if (host_ex & FE_DIVBYZERO) ex |= FPCALL_EX_DZ;
+  if (host_ex & FE_INVALID  ) ex |= FPCALL_EX_NV;
+  return ex;
+}
+
+void fp_host_sync() {
+  int host_ex = fetestexcept(FE_ALL_EXCEPT);
+  if (likely(host_ex == 0)) return;
+  feclearexcept(FE_ALL_EXCEPT);
+  isa_fp_set_ex(host_get_exception(host_ex));
+}
+
+// Called when host code may run floating point operations,
+// which should neither see the guest rounding mode nor raise guest flags.
+void fp_host_leave() {
+  fp_host_sync();
+  host_set_rm(FE_TONEAREST);
+}
+
+void fp_host_enter() {
+  feclearexcept(FE_ALL_EXCEPT);
+}
+
+#define NR_FP_TEST 2048
+
+// test_val() for floating point numbers
+static rtlreg_t fp_test_val(int i, uint32_t w, uint64_t *seed) {
+  uint64_t x = test_rand(seed);
+  int frac_bits = (w == FPCALL_W32 ? 23 : 52);
+  uint64_t exp_max = (w == FPCALL_W32 ? 0xff : 0x7ff);
+  uint64_t frac = x & ((1ul << frac_bits) - 1);
+  uint64_t exp;
+  switch (i % 4) {
+    case 0: exp = (x >> 52) & exp_max; break;
+    case 1: exp = 0; break; // subnormal and zero
+    case 2: { // boundaries
+      uint64_t exps[] = { 0, 1, (exp_max >> 1) - 1, exp_max >> 1, exp_max - 1, exp_max };
+      uint64_t fracs[] = { 0, 1, (1ul << frac_bits) - 1, frac };
+      exp = exps[(x >> 52) % ARRLEN(exps)];
+      frac = fracs[(x >> 60) % ARRLEN(fracs)];
+      break;
+    }
+    default: // close to overflow or underflow
+      exp = ((x >> 52) & 1) ? exp_max - 1 - (x >> 53) % 8 : 1 + (x >> 53) % 8;
+  }
+  uint64_t v = ((x >> 63) << (w == FPCALL_W32 ? 31 : 63)) | (exp << frac_bits) | frac;
+  return (w == FPCALL_W32 ? BOX_MASK | v : v);
+}
+
+static rtlreg_t fp_soft_call(uint32_t op, uint32_t w, rtlreg_t a, rtlreg_t b, rtlreg_t c) {
+  if (w == FPCALL_W32) {
+    float32_t fa = rtlToF32(a), fb = rtlToF32(b), fc = rtlToF32(c);
+    switch (op) {
+      case FPCALL_ADD:  return f32_add(fa, fb).v;
+      case FPCALL_SUB:  return f32_sub(fa, fb).v;
+      case FPCALL_MUL:  return f32_mul(fa, fb).v;
+      case FPCALL_DIV:  return f32_div(fa, fb).v;
+      case FPCALL_SQRT: return f32_sqrt(fa).v;
+      default:          return f32_mulAdd(fa, fb, fc).v;
+    }
+  } else {
+    float64_t fa = rtlToF64(a), fb = rtlToF64(b), fc = rtlToF64(c);
+    switch (op) {
+      case FPCALL_ADD:  return f64_add(fa, fb).v;
+      case FPCALL_SUB:  return f64_sub(fa, fb).v;
+      case FPCALL_MUL:  return f64_mul(fa, fb).v;
+      case FPCALL_DIV:  return f64_div(fa, fb).v;
+      case FPCALL_SQRT: return f64_sqrt(fa).v;
+      default:          return f64_mulAdd(fa, fb, fc).v;
+    }
+  }
+}
+
+// return whether fp_host_call() gives the same result and flags as softfloat
+static bool fp_host_check(uint32_t op, uint32_t w, uint32_t rm, rtlreg_t a, rtlreg_t b, rtlreg_t c) {
+  rtlreg_t host_res = c;
+  feclearexcept(FE_ALL_EXCEPT);
+  if (!fp_host_call(&host_res, &a, &b, op, w, rm)) return true;
+  uint32_t host_ex = host_get_exception(fetestexcept(FE_ALL_EXCEPT));
+
+  fp_set_rm(rm);
+  fp_clear_exception();
+  rtlreg_t soft_res = fp_soft_call(op, w, a, b, c);
+  uint32_t soft_ex = fp_get_exception();
+
+  if (w == FPCALL_W32) { host_res = (uint32_t)host_res; soft_res = (uint32_t)soft_res; }
+  if (host_res == soft_res && host_ex == soft_ex) return true;
+  Log("fp_host_call(op = %d, w = %d, rm = %d) = 0x%lx with flags 0x%x, but softfloat = 0x%lx "
+      "with flags 0x%x on 0x%lx, 0x%lx, 0x%lx, use softfloat",
+      op, w, rm, host_res, host_ex, soft_res, soft_ex, a, b, c);
+  return false;
+}
+
+// Compare host FPU with softfloat on random, subnormal, boundary and overflowing
+// operands in all rounding modes handled by fp_host_call().
+static void fp_host_selftest() {
+  uint_fast8_t soft_rm = softfloat_roundingMode;
+  uint64_t seed = TEST_SEED;
+  for (uint32_t w = FPCALL_W32; w <= FPCALL_W64 && fp_host_enabled; w ++) {
+    for (int i = 0; i < NR_FP_TEST && fp_host_enabled; i ++) {
+      rtlreg_t a = fp_test_val(i, w, &seed);
+      rtlreg_t b = fp_test_val(i / 4, w, &seed);
+      rtlreg_t c = fp_test_val(i / 16, w, &seed);
+      for (uint32_t op = FPCALL_ADD; op <= FPCALL_MADD && fp_host_enabled; op ++) {
+        for (uint32_t rm = FPCALL_RM_RNE; rm <= FPCALL_RM_RUP && fp_host_enabled; rm ++) {
+          fp_host_enabled = fp_host_check(op, w, rm, a, b, c);
+        }
+      }
+    }
+  }
+  softfloat_roundingMode = soft_rm;
+  fp_clear_exception();
+  feclearexcept(FE_ALL_EXCEPT);
+  host_set_rm(FE_TONEAREST);
+}
+
+void init_fp_host() {
+  fp_host_selftest();
+  Log("Host FPU for add/sub/mul/div/sqrt/fma: %s", fp_host_enabled ? "enabled" : "disabled");
+}
+#endif // CONFIG_FPU_SOFT_HOST
 #endif // CONFIG_FPU_NONE
 
 def_rtl(fpcall, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2, uint32_t cmd) {
@@ -46,12 +245,15 @@ def_rtl(fpcall, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2, uint
   uint32_t op = FPCALL_OP(cmd);
   isa_fp_csr_check();
   if (op < FPCALL_NEED_RM) {
-    static uint32_t last_rm = -1;
+    static GUEST_THREAD_LOCAL uint32_t last_rm = -1;
     uint32_t rm = isa_fp_get_rm(s);
     if (unlikely(rm != last_rm)) {
       fp_set_rm(rm);
       last_rm = rm;
     }
+#ifdef CONFIG_FPU_SOFT_HOST
+    if (op <= FPCALL_MADD && likely(fp_host_enabled) && fp_host_call(dest, src1, src2, op, w, rm)) return;
+#endif
   }
 
   if (w == FPCALL_W32) {
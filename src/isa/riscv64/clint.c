@@ -13,11 +13,15 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include <isa.h>
 #include <utils.h>
 #include <device/alarm.h>
 #include <device/map.h>
+#include <signal.h>
 #include "local-include/csr.h"
+#include "local-include/hart.h"
 
+#define CLINT_MSIP     (0x0000 / sizeof(uint32_t))
 #define CLINT_MTIMECMP (0x4000 / sizeof(clint_base[0]))
 #define CLINT_MTIME    (0xBFF8 / sizeof(clint_base[0]))
 #define TIMEBASE 10000000ul
@@ -26,7 +30,7 @@ static uint64_t *clint_base = NULL;
 static uint64_t boot_time = 0;
 uint64_t clint_snapshot, spec_clint_snapshot;
 
-extern uint64_t g_nr_guest_instr;
+extern GUEST_THREAD_LOCAL uint64_t g_nr_guest_instr;
 extern uint64_t stable_log_begin, spec_log_begin;
 
 void clint_take_snapshot() {
@@ -51,14 +55,43 @@ void update_clint() {
   uint64_t now = get_time() - boot_time;
   clint_base[CLINT_MTIME] = TIMEBASE * now / 1000000;
 #endif
+#ifdef CONFIG_MULTIHART
+  // every hart has its own msip and mtimecmp
+  for (int i = 0; i < hart_nr(); i ++) {
+    mip_t *p = hart_mip(i);
+    p->mtip = (clint_base[CLINT_MTIME] >= clint_base[CLINT_MTIMECMP + i]);
+    p->msip = ((uint32_t *)clint_base)[CLINT_MSIP + i] & 1;
+  }
+#else
   mip->mtip = (clint_base[CLINT_MTIME] >= clint_base[CLINT_MTIMECMP]);
+#endif // CONFIG_MULTIHART
+  difftest_mark_csr(mip);
+}
+
+#ifdef CONFIG_MULTIHART
+// The alarm may interrupt hart_switch() in the middle, when the mip of a hart
+// is neither in csr_array nor in its context. So the alarm only requests an
+// update, which clint_sync() does between two batches.
+static volatile sig_atomic_t clint_update_pending = false;
+
+static void clint_alarm() {
+  clint_update_pending = true;
 }
 
+void clint_sync() {
+  if (clint_update_pending) {
+    clint_update_pending = false;
+    update_clint();
+  }
+}
+#endif // CONFIG_MULTIHART
+
 uint64_t clint_uptime() {
   update_clint();
   return clint_base[CLINT_MTIME];
 }
 
+__attribute__((unused))
 static void clint_io_handler(uint32_t offset, int len, bool is_write) {
 #ifdef CONFIG_LIGHTQS_DEBUG
   printf("clint op write %d addr %x\n", is_write, offset);
@@ -67,9 +100,15 @@ static void clint_io_handler(uint32_t offset, int len, bool is_write) {
 }
 
 void init_clint() {
+#ifdef CONFIG_MODE_USER
+  // there is no MMIO in user mode, only the time CSR reads mtime
+  static uint64_t clint_regs[0x10000 / sizeof(uint64_t)];
+  clint_base = clint_regs;
+#else
   clint_base = (uint64_t *)new_space(0x10000);
   add_mmio_map("clint", CONFIG_CLINT_MMIO, (uint8_t *)clint_base, 0x10000, clint_io_handler);
-  IFNDEF(CONFIG_DETERMINISTIC, add_alarm_handle(update_clint));
+  IFNDEF(CONFIG_DETERMINISTIC, add_alarm_handle(MUXDEF(CONFIG_MULTIHART, clint_alarm, update_clint)));
+#endif
   boot_time = get_time();
 }
 
@@ -18,8 +18,12 @@
 #include <cpu/cpu.h>
 #include <cpu/exec.h>
 #include <difftest.h>
+#include <memory/paddr.h>
 #include "../local-include/intr.h"
 #include "../local-include/csr.h"
+#include "../local-include/reg.h"
+#include "../local-include/trigger.h"
+#include "../local-include/hart.h"
 #include <generated/autoconf.h>
 #include <stdlib.h>
 
@@ -144,11 +148,157 @@ void csr_writeback() {
   vsscratch->val = cpu.vsscratch;
 #endif
 }
+// Delta sync keeps a shadow of the state DUT has seen in the last sync.
+// The write paths mark the words and CSRs they change in the dirty bitmaps
+// below, and a delta sync only compares the marked ones with the shadow.
+// A sync with an invalid shadow, such as the first one, compares everything.
+#define REG_WORDS (DIFFTEST_REG_SIZE / sizeof(uint64_t))
+#define BITMAP_WORDS(n) (((n) + 63) / 64)
+static uint64_t reg_shadow[REG_WORDS];
+static rtlreg_t csr_shadow[4096];
+static bool reg_shadow_valid = false, csr_shadow_valid = false;
+uint64_t reg_dirty[BITMAP_WORDS(REG_WORDS)];
+IFDEF(CONFIG_RVV, uint32_t vreg_dirty);
+uint64_t csr_dirty[4096 / 64], csr_mirror_dirty[4096 / 64];
+
+#define reg_word(p) ((uint64_t *)(p) - (uint64_t *)&cpu)
+#define csr_addr(name) ((rtlreg_t *)(name) - csr_array)
+#define reg_set_dirty(i) (reg_dirty[(i) / 64] |= 1ull << ((i) % 64))
+
+// the CSRs mirrored by csr_prepare(), except sstatus which follows mstatus
+#define CSR_MIRRORS(f) \
+  f(mstatus) f(mcause) f(mepc) f(scause) f(sepc) f(satp) f(mip) f(mie) \
+  f(mscratch) f(sscratch) f(mideleg) f(medeleg) f(mtval) f(stval) f(mtvec) f(stvec) \
+  IFDEF(CONFIG_RVV, CSR_MIRRORS_RVV(f)) IFDEF(CONFIG_RVH, CSR_MIRRORS_RVH(f))
+#define CSR_MIRRORS_RVV(f) \
+  f(vstart) f(vxsat) f(vxrm) f(vcsr) f(vl) f(vtype) f(vlenb)
+#define CSR_MIRRORS_RVH(f) \
+  f(mtval2) f(mtinst) f(hstatus) f(hideleg) f(hedeleg) f(hcounteren) f(htval) f(htinst) \
+  f(hgatp) f(vsstatus) f(vstvec) f(vsepc) f(vscause) f(vstval) f(vsatp) f(vsscratch)
+
+static uint16_t csr_mirror[4096]; // word of the mirror in cpu, 0 if none
+
+static void init_csr_mirror() {
+#define MIRROR(name) csr_mirror[csr_addr(name)] = reg_word(&cpu.name);
+  MAP(CSR_MIRRORS, MIRROR)
+#undef MIRROR
+}
+
+#ifdef CONFIG_SHARE
+void difftest_mark_trap() {
+  difftest_mark_reg(&cpu.mode);
+  difftest_mark_csr(mstatus);
+  difftest_mark_csr(mcause);
+  difftest_mark_csr(mepc);
+  difftest_mark_csr(mtval);
+  difftest_mark_csr(scause);
+  difftest_mark_csr(sepc);
+  difftest_mark_csr(stval);
+#ifdef CONFIG_RVH
+  difftest_mark_reg(&cpu.v);
+  difftest_mark_csr(mtval2);
+  difftest_mark_csr(mtinst);
+  difftest_mark_csr(hstatus);
+  difftest_mark_csr(htval);
+  difftest_mark_csr(htinst);
+  difftest_mark_csr(vsstatus);
+  difftest_mark_csr(vscause);
+  difftest_mark_csr(vsepc);
+  difftest_mark_csr(vstval);
+#endif // CONFIG_RVH
+}
+#endif // CONFIG_SHARE
+
+// the shadow of the registers is in sync with DUT
+static void reg_delta_clear() {
+  memset(reg_dirty, 0, sizeof(reg_dirty));
+  IFDEF(CONFIG_RVV, vreg_dirty = 0);
+  memset(csr_mirror_dirty, 0, sizeof(csr_mirror_dirty));
+}
+
+// the state is replaced as a whole, e.g. by a snapshot restore
+static inline void delta_invalidate() {
+  reg_shadow_valid = false;
+  csr_shadow_valid = false;
+}
+
+#define for_each_bit(bitmap, nr_words, i) \
+  for (int __w = 0; __w < (nr_words); __w ++) \
+    for (uint64_t __m = (bitmap)[__w]; __m != 0 && ((i) = __w * 64 + __builtin_ctzll(__m), 1); __m &= __m - 1)
+
+int isa_difftest_regcpy_delta(uint32_t *idx, uint64_t *val) {
+  uint64_t *reg = (uint64_t *)&cpu;
+  int n = 0, i;
+  if (!reg_shadow_valid) {
+    csr_prepare();
+    for (i = 0; i < REG_WORDS; i ++) {
+      idx[n] = i;
+      val[n] = reg_shadow[i] = reg[i];
+      n ++;
+    }
+    reg_delta_clear();
+    reg_shadow_valid = true;
+    return n;
+  }
+
+  if (unlikely(csr_mirror[csr_addr(mstatus)] == 0)) init_csr_mirror();
+  // refresh the mirrors of the CSRs written, as csr_prepare() does
+  for_each_bit(csr_mirror_dirty, 4096 / 64, i) {
+    if (csr_mirror[i] != 0) {
+      reg[csr_mirror[i]] = csr_array[i];
+      reg_set_dirty(csr_mirror[i]);
+    }
+  }
+  memset(csr_mirror_dirty, 0, sizeof(csr_mirror_dirty));
+  cpu.sstatus = mstatus->val & SSTATUS_RMASK;
+  reg_set_dirty(reg_word(&cpu.sstatus));
+  reg_set_dirty(reg_word(&cpu.pc));
+#ifdef CONFIG_RVV
+  for (; vreg_dirty != 0; vreg_dirty &= vreg_dirty - 1) {
+    int r = __builtin_ctz(vreg_dirty);
+    for (int j = 0; j < VENUM64; j ++) reg_set_dirty(reg_word(&cpu.vr[r]._64[j]));
+  }
+#endif // CONFIG_RVV
+
+  for_each_bit(reg_dirty, BITMAP_WORDS(REG_WORDS), i) {
+    if (reg[i] != reg_shadow[i]) {
+      idx[n] = i;
+      val[n] = reg_shadow[i] = reg[i];
+      n ++;
+    }
+  }
+  memset(reg_dirty, 0, sizeof(reg_dirty));
+  return n;
+}
+
+int isa_difftest_csrcpy_delta(uint32_t *idx, uint64_t *val) {
+  int n = 0, addr;
+  if (!csr_shadow_valid) {
+    for (int i = 0; i < nr_csr_impl; i ++) {
+      addr = csr_impl_addrs[i];
+      idx[n] = addr;
+      val[n] = csr_shadow[addr] = csr_array[addr];
+      n ++;
+    }
+    csr_shadow_valid = true;
+  } else {
+    for_each_bit(csr_dirty, 4096 / 64, addr) {
+      if (csr_array[addr] != csr_shadow[addr]) {
+        idx[n] = addr;
+        val[n] = csr_shadow[addr] = csr_array[addr];
+        n ++;
+      }
+    }
+  }
+  memset(csr_dirty, 0, sizeof(csr_dirty));
+  return n;
+}
+
 #ifdef CONFIG_LIGHTQS
 extern uint64_t stable_log_begin, spec_log_begin;
 
 extern struct lightqs_reg_ss reg_ss;
-extern uint64_t g_nr_guest_instr;
+extern GUEST_THREAD_LOCAL uint64_t g_nr_guest_instr;
 void isa_difftest_regcpy(void *dut, bool direction, bool restore, uint64_t restore_count) {
   if (restore) {
     uint64_t left_exec = lightqs_restore_reg_snapshot(restore_count);
@@ -157,6 +307,7 @@ void isa_difftest_regcpy(void *dut, bool direction, bool restore, uint64_t resto
     printf("left exec = %lx\n", left_exec);
     #endif // CONFIG_LIGHTQS_DEBUG
     pmem_record_restore(reg_ss.inst_cnt);
+  delta_invalidate();
     // clint_restore_snapshot(restore_count);
 
     if (spec_log_begin <= restore_count) {
@@ -172,6 +323,8 @@ void isa_difftest_regcpy(void *dut, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
     csr_writeback();
+    // DUT does not know the CSRs written back
+    csr_shadow_valid = false;
     // need to clear the cached mmu states as well
     extern void update_mmu_state();
     update_mmu_state();
@@ -179,6 +332,10 @@ void isa_difftest_regcpy(void *dut, bool direction) {
     csr_prepare();
     memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
   }
+  // DUT holds the same registers as REF now
+  memcpy(reg_shadow, dut, DIFFTEST_REG_SIZE);
+  reg_delta_clear();
+  reg_shadow_valid = true;
 #ifdef CONFIG_LIGHTQS
   // after processing, take another snapshot
   // FIXME: update spec_log_begin
@@ -199,14 +356,20 @@ void isa_difftest_regcpy(void *dut, bool direction) {
 void isa_difftest_csrcpy(void *dut, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     memcpy(csr_array, dut, 4096 * sizeof(rtlreg_t));
+    // the CSR mirrors in the registers may change
+    memset(csr_mirror_dirty, 0xff, sizeof(csr_mirror_dirty));
   } else {
     memcpy(dut, csr_array, 4096 * sizeof(rtlreg_t));
   }
+  memcpy(csr_shadow, csr_array, sizeof(csr_shadow));
+  memset(csr_dirty, 0, sizeof(csr_dirty));
+  csr_shadow_valid = true;
 }
 #ifdef CONFIG_LIGHTQS
 void isa_difftest_uarchstatus_cpy(void *dut, bool direction, uint64_t restore_count) {
   uint64_t left_exec = lightqs_restore_reg_snapshot(restore_count);
   pmem_record_restore(reg_ss.inst_cnt);
+  delta_invalidate();
   // clint_restore_snapshot(restore_count);
 
   if (spec_log_begin <= restore_count) {
@@ -249,6 +412,7 @@ void isa_difftest_raise_intr(word_t NO, uint64_t restore_count) {
 
   uint64_t left_exec = lightqs_restore_reg_snapshot(restore_count);
   pmem_record_restore(reg_ss.inst_cnt);
+  delta_invalidate();
   // clint_restore_snapshot(restore_count);
 
   if (spec_log_begin <= restore_count) {
@@ -284,6 +448,7 @@ void isa_difftest_guided_exec(void * guide, uint64_t restore_count) {
 
   uint64_t left_exec = lightqs_restore_reg_snapshot(restore_count);
   pmem_record_restore(reg_ss.inst_cnt);
+  delta_invalidate();
   // clint_restore_snapshot(restore_count);
 
   if (spec_log_begin <= restore_count) {
@@ -345,6 +510,28 @@ void isa_difftest_query_ref(void *result_buffer, uint64_t type) {
 }
 #endif
 
+// check the destination register written by the last instruction, see struct DifftestCommit
+bool isa_difftest_check_wdata(int wen, int wdest, uint64_t wdata) {
+  switch (wen) {
+    case 1: return wdest == 0 || cpu.gpr[wdest]._64 == wdata;
+#ifndef CONFIG_FPU_NONE
+    case 2: return cpu.fpr[wdest]._64 == wdata;
+#endif // CONFIG_FPU_NONE
+    default: return true;
+  }
+}
+
+// write the destination register of a skipped instruction, see struct DifftestCommit
+void isa_difftest_set_wdata(int wen, int wdest, uint64_t wdata) {
+  switch (wen) {
+    case 1: if (wdest != 0) cpu.gpr[wdest]._64 = wdata; difftest_mark_reg(&cpu.gpr[wdest]); break;
+#ifndef CONFIG_FPU_NONE
+    case 2: cpu.fpr[wdest]._64 = wdata; difftest_mark_reg(&cpu.fpr[wdest]); break;
+#endif // CONFIG_FPU_NONE
+    default: break;
+  }
+}
+
 char *reg_dump_file = NULL;
 
 void dump_regs() {
@@ -391,8 +578,102 @@ void dump_regs() {
 #endif // CONFIG_FPU_NONE
 }
 
+#if defined(CONFIG_REF_SNAPSHOT) || defined(CONFIG_USER_THREADS)
+typedef struct {
+  CPU_state cpu;
+  rtlreg_t csr_array[4096];
+#ifdef CONFIG_RVSDTRIG
+  TriggerModule tm;
+#endif
+} ISASnapshot;
+
+size_t isa_snapshot_size() {
+  return sizeof(ISASnapshot);
+}
+
+void isa_snapshot_save(void *buf) {
+  ISASnapshot *ss = (ISASnapshot *)buf;
+#ifdef CONFIG_FPU_SOFT_HOST
+  void fp_host_sync();
+  fp_host_sync();
+#endif
+  ss->cpu = cpu;
+  memcpy(ss->csr_array, csr_array, sizeof(ss->csr_array));
+  IFDEF(CONFIG_RVSDTRIG, ss->tm = *cpu.TM);
+}
+
+void isa_snapshot_restore(const void *buf) {
+  const ISASnapshot *ss = (const ISASnapshot *)buf;
+  cpu = ss->cpu;
+  memcpy(csr_array, ss->csr_array, sizeof(ss->csr_array));
+  IFDEF(CONFIG_RVSDTRIG, *cpu.TM = ss->tm);
+  IFDEF(CONFIG_SHARE, delta_invalidate());
+  // recompute the states cached from CSRs
+  extern void update_mmu_state();
+  update_mmu_state();
+#ifndef CONFIG_FPU_NONE
+  void fp_update_rm_cache(uint32_t rm);
+  fp_update_rm_cache(fcsr->frm);
+#endif // CONFIG_FPU_NONE
+}
+#endif // CONFIG_REF_SNAPSHOT || CONFIG_USER_THREADS
+
+#ifdef CONFIG_MULTIHART_REF
+// The delta sync shadows and dirty bitmaps of the harts not selected
+typedef struct {
+  uint64_t reg[REG_WORDS];
+  rtlreg_t *csr;
+  bool reg_valid, csr_valid;
+  uint64_t reg_dirty[BITMAP_WORDS(REG_WORDS)];
+  IFDEF(CONFIG_RVV, uint32_t vreg_dirty);
+  uint64_t csr_dirty[4096 / 64], csr_mirror_dirty[4096 / 64];
+} HartShadow;
+
+static HartShadow *hart_shadows = NULL;
+
+void isa_difftest_set_nr_hart(int n) {
+  assert(hart_shadows == NULL);
+  hart_shadows = calloc(n, sizeof(HartShadow));
+  assert(hart_shadows);
+  for (int i = 0; i < n; i ++) {
+    hart_shadows[i].csr = calloc(nr_csr_impl, sizeof(rtlreg_t));
+    assert(hart_shadows[i].csr);
+  }
+  init_hart(n);
+}
+
+void isa_difftest_select_hart(int id) {
+  int old = hart_id();
+  if (id == old) return;
+  HartShadow *h = &hart_shadows[old];
+  memcpy(h->reg, reg_shadow, sizeof(reg_shadow));
+  for (int i = 0; i < nr_csr_impl; i ++) h->csr[i] = csr_shadow[csr_impl_addrs[i]];
+  h->reg_valid = reg_shadow_valid;
+  h->csr_valid = csr_shadow_valid;
+  memcpy(h->reg_dirty, reg_dirty, sizeof(reg_dirty));
+  IFDEF(CONFIG_RVV, h->vreg_dirty = vreg_dirty);
+  memcpy(h->csr_dirty, csr_dirty, sizeof(csr_dirty));
+  memcpy(h->csr_mirror_dirty, csr_mirror_dirty, sizeof(csr_mirror_dirty));
+
+  hart_switch(id);
+
+  h = &hart_shadows[id];
+  memcpy(reg_shadow, h->reg, sizeof(reg_shadow));
+  for (int i = 0; i < nr_csr_impl; i ++) csr_shadow[csr_impl_addrs[i]] = h->csr[i];
+  reg_shadow_valid = h->reg_valid;
+  csr_shadow_valid = h->csr_valid;
+  memcpy(reg_dirty, h->reg_dirty, sizeof(reg_dirty));
+  IFDEF(CONFIG_RVV, vreg_dirty = h->vreg_dirty);
+  memcpy(csr_dirty, h->csr_dirty, sizeof(csr_dirty));
+  memcpy(csr_mirror_dirty, h->csr_mirror_dirty, sizeof(csr_mirror_dirty));
+  // the CLINT updates mip of the parked harts without marking it
+  difftest_mark_csr(mip);
+}
+#endif // CONFIG_MULTIHART_REF
+
 #ifdef CONFIG_MULTICORE_DIFF
 void isa_difftest_set_mhartid(int n) {
   mhartid->val = n;
+  difftest_mark_csr(mhartid);
 }
 #endif
@@ -116,6 +116,10 @@ typedef struct {
   // for LR/SC
   uint64_t lr_addr;
   uint64_t lr_valid;
+  uint64_t lr_value;
+#ifdef CONFIG_HART_CONTEXT
+  uint64_t lr_paddr;
+#endif
 
   bool INTR;
 
@@ -17,6 +17,7 @@
 #include <isa.h>
 #include <memory/paddr.h>
 #include "local-include/csr.h"
+#include "local-include/hart.h"
 
 #ifndef CONFIG_SHARE
 static const uint32_t img [] = {
@@ -36,6 +37,12 @@ void init_trigger();
 void init_clint();
 #endif
 void init_device();
+#if defined(CONFIG_RVB) || defined(CONFIG_RVK)
+void init_host_intrin();
+#endif
+#ifdef CONFIG_FPU_SOFT_HOST
+void init_fp_host();
+#endif
 
 void init_isa() {
   // NEMU has some cached states and some static variables in the source code.
@@ -105,6 +112,18 @@ void init_isa() {
   #endif // CONFIG_USE_XS_ARCH_CSRS
 #endif // CONFIG_RV_ARCH_CSRS
 
+#if defined(CONFIG_RVB) || defined(CONFIG_RVK)
+  if (!is_second_call) {
+    init_host_intrin();
+  }
+#endif
+
+#ifdef CONFIG_FPU_SOFT_HOST
+  if (!is_second_call) {
+    init_fp_host();
+  }
+#endif
+
 #ifdef CONFIG_RVSDTRIG
   init_trigger();
 #endif // CONFIG_RVSDTRIG
@@ -120,12 +139,20 @@ void init_isa() {
   init_clint();
   #endif
 
+#ifdef CONFIG_MULTIHART
+  if (!is_second_call) {
+    init_hart(CONFIG_NR_HART);
+  }
+#endif // CONFIG_MULTIHART
+
   if (!is_second_call) {
     IFDEF(CONFIG_SHARE, init_device());
   }
 
 #ifndef CONFIG_SHARE
   Log("NEMU will start from pc 0x%lx", cpu.pc);
+  IFDEF(CONFIG_MULTIHART, Log("Simulating %d harts, switching every %d instructions",
+        CONFIG_NR_HART, CONFIG_HART_QUANTUM));
 #endif
 
   is_second_call = true;
@@ -114,6 +114,8 @@ int isa_fetch_decode(Decode *s) {
     s->isa.instr.val |= (hi << 16);
     idx = table_main(s);
   }
+  // in REF, mark the destination register here instead of in every instruction
+  IFDEF(CONFIG_SHARE, difftest_mark_dest(id_dest->preg));
 
 #ifdef CONFIG_RVSDTRIG
   if (cpu.TM->check_timings.af) {
@@ -19,7 +19,7 @@
 #include <rtl/fp.h>
 #include <cpu/cpu.h>
 
-static uint32_t nemu_rm_cache = 0;
+static GUEST_THREAD_LOCAL uint32_t nemu_rm_cache = 0;
 void fp_update_rm_cache(uint32_t rm) {
   switch (rm) {
     case 0: nemu_rm_cache = FPCALL_RM_RNE; return;
@@ -36,6 +36,7 @@ bool fp_enable() {
 }
 
 void fp_set_dirty() {
+  difftest_mark_csr(mstatus);
   // lazily update mstatus->sd when reading mstatus
 #if defined (CONFIG_SHARE) || defined (CONFIG_DIFFTEST_REF_SPIKE)
   mstatus->sd = 1;
@@ -44,17 +45,11 @@ void fp_set_dirty() {
   mstatus->fs = 3;
 }
 
+// A static rm is checked by fp_rm_illegal() at decode time,
+// and FPCALL_RM_* follow the encoding of rm.
 uint32_t isa_fp_get_rm(Decode *s) {
   uint32_t rm = s->isa.instr.fp.rm;
-  if (likely(rm == 7)) { return nemu_rm_cache; }
-  switch (rm) {
-    case 0: return FPCALL_RM_RNE;
-    case 1: return FPCALL_RM_RTZ;
-    case 2: return FPCALL_RM_RDN;
-    case 3: return FPCALL_RM_RUP;
-    case 4: return FPCALL_RM_RMM;
-    default: save_globals(s); longjmp_exception(EX_II);
-  }
+  return likely(rm == 7) ? nemu_rm_cache : rm;
 }
 
 void isa_fp_set_ex(uint32_t ex) {
@@ -67,15 +62,18 @@ void isa_fp_set_ex(uint32_t ex) {
   if (ex & FPCALL_EX_NV) f |= 0x10;
   fcsr->fflags.val = fcsr->fflags.val | f;
   fflags->val = fcsr->fflags.val;
+  difftest_mark_csr(fflags);
+  difftest_mark_csr(fcsr);
   fp_set_dirty();
 #endif // CONFIG_FPU_NONE
 }
 
 void isa_fp_csr_check() {
-#ifndef CONFIG_FPU_NONE
+  // mstatus is not accessible in user mode, so FPU is always enabled
+#if !defined(CONFIG_FPU_NONE) && !defined(CONFIG_MODE_USER)
   if(unlikely(mstatus->fs == 0)){
     longjmp_exception(EX_II);
     assert(0);
   }
-#endif // CONFIG_FPU_NONE
+#endif
 }
@@ -0,0 +1,170 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#if defined(CONFIG_RVB) || defined(CONFIG_RVK)
+#include "host-intrin.h"
+
+HostIntrin host_intrin = {};
+
+#ifdef __x86_64__
+#include <immintrin.h>
+
+__attribute__((target("popcnt")))
+uint64_t host_cpop(uint64_t rs1) { return _mm_popcnt_u64(rs1); }
+__attribute__((target("popcnt")))
+uint64_t host_cpopw(uint64_t rs1) { return _mm_popcnt_u32(rs1); }
+
+__attribute__((target("pclmul")))
+static inline __m128i clmul128(uint64_t rs1, uint64_t rs2) {
+  return _mm_clmulepi64_si128(_mm_cvtsi64_si128(rs1), _mm_cvtsi64_si128(rs2), 0);
+}
+
+__attribute__((target("pclmul")))
+uint64_t host_clmul(uint64_t rs1, uint64_t rs2) {
+  return _mm_cvtsi128_si64(clmul128(rs1, rs2));
+}
+
+__attribute__((target("pclmul")))
+uint64_t host_clmulh(uint64_t rs1, uint64_t rs2) {
+  __m128i x = clmul128(rs1, rs2);
+  return _mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x));
+}
+
+__attribute__((target("pclmul")))
+uint64_t host_clmulr(uint64_t rs1, uint64_t rs2) {
+  __m128i x = clmul128(rs1, rs2);
+  uint64_t lo = _mm_cvtsi128_si64(x);
+  uint64_t hi = _mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x));
+  return (hi << 1) | (lo >> 63);
+}
+
+// Indices out of rs1 are clamped to 8, which selects a zero byte.
+__attribute__((target("ssse3")))
+uint64_t host_xpermb(uint64_t rs1, uint64_t rs2) {
+  __m128i idx = _mm_min_epu8(_mm_cvtsi64_si128(rs2), _mm_set1_epi8(8));
+  return _mm_cvtsi128_si64(_mm_shuffle_epi8(_mm_cvtsi64_si128(rs1), idx));
+}
+
+#ifdef CONFIG_RVK
+// The AES state {rs2, rs1} has the same byte order as an xmm register,
+// and a zero round key turns the AES-NI rounds into the RVK instructions.
+#define AES_STATE(rs1, rs2) _mm_set_epi64x(rs2, rs1)
+
+__attribute__((target("aes")))
+uint64_t host_aes64es(uint64_t rs1, uint64_t rs2) {
+  return _mm_cvtsi128_si64(_mm_aesenclast_si128(AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+uint64_t host_aes64esm(uint64_t rs1, uint64_t rs2) {
+  return _mm_cvtsi128_si64(_mm_aesenc_si128(AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+uint64_t host_aes64ds(uint64_t rs1, uint64_t rs2) {
+  return _mm_cvtsi128_si64(_mm_aesdeclast_si128(AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+uint64_t host_aes64dsm(uint64_t rs1, uint64_t rs2) {
+  return _mm_cvtsi128_si64(_mm_aesdec_si128(AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+uint64_t host_aes64im(uint64_t rs1) {
+  return _mm_cvtsi128_si64(_mm_aesimc_si128(AES_STATE(rs1, 0)));
+}
+#endif // CONFIG_RVK
+
+#define NR_TEST 4096
+
+#define check_op(feature, host, ref, ...) do { \
+  uint64_t host_res = host(__VA_ARGS__), ref_res = ref(__VA_ARGS__); \
+  if (host_intrin.feature && host_res != ref_res) { \
+    Log(str(host) " = 0x%lx, but " str(ref) " = 0x%lx on 0x%lx, use the C version", \
+        host_res, ref_res, a); \
+    host_intrin.feature = false; \
+  } \
+} while (0)
+
+// Compare the host versions with the C versions. As in execute(), the C
+// versions are included as nested functions, and only some of them are used.
+static void host_intrin_selftest() {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "rvb/rvintrin.h"
+#ifdef CONFIG_RVK
+#include "rvk/crypto_impl.h"
+#endif
+#pragma GCC diagnostic pop
+
+  uint64_t seed = TEST_SEED;
+  for (int i = 0; i < NR_TEST; i ++) {
+    uint64_t a = test_val(i, &seed);
+    uint64_t b = test_val(i / 4, &seed);
+    if (host_intrin.popcnt) {
+      check_op(popcnt, host_cpop, _rv_cpop, a);
+      check_op(popcnt, host_cpopw, _rv32_cpop, a);
+    }
+    if (host_intrin.pclmul) {
+      check_op(pclmul, host_clmul, _rv_clmul, a, b);
+      check_op(pclmul, host_clmulh, _rv_clmulh, a, b);
+      check_op(pclmul, host_clmulr, _rv_clmulr, a, b);
+    }
+    if (host_intrin.ssse3) {
+      // make half of the indices in range
+      uint64_t idx = (i & 1) ? b & 0x0707070707070707ul : b;
+      check_op(ssse3, host_xpermb, _rv_xpermb, a, idx);
+    }
+#ifdef CONFIG_RVK
+    if (host_intrin.aes) {
+      check_op(aes, host_aes64es, aes64es, a, b);
+      check_op(aes, host_aes64esm, aes64esm, a, b);
+      check_op(aes, host_aes64ds, aes64ds, a, b);
+      check_op(aes, host_aes64dsm, aes64dsm, a, b);
+      check_op(aes, host_aes64im, aes64im, a);
+    }
+#endif
+  }
+}
+#else
+// not used on other hosts, since all features are disabled
+uint64_t host_cpop  (uint64_t rs1) { panic("not supported"); }
+uint64_t host_cpopw (uint64_t rs1) { panic("not supported"); }
+uint64_t host_clmul (uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_clmulh(uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_clmulr(uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_xpermb(uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_aes64es (uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_aes64esm(uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_aes64ds (uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_aes64dsm(uint64_t rs1, uint64_t rs2) { panic("not supported"); }
+uint64_t host_aes64im (uint64_t rs1) { panic("not supported"); }
+#endif // __x86_64__
+
+void init_host_intrin() {
+#ifdef __x86_64__
+  __builtin_cpu_init();
+  host_intrin.popcnt = __builtin_cpu_supports("popcnt");
+  host_intrin.pclmul = __builtin_cpu_supports("pclmul");
+  host_intrin.ssse3  = __builtin_cpu_supports("ssse3");
+  host_intrin.aes    = ISDEF(CONFIG_RVK) && __builtin_cpu_supports("aes");
+  host_intrin_selftest();
+  Log("Host intrinsics for RVB/RVK: popcnt %d, pclmul %d, ssse3 %d, aes %d",
+      host_intrin.popcnt, host_intrin.pclmul, host_intrin.ssse3, host_intrin.aes);
+#endif
+}
+#endif // CONFIG_RVB || CONFIG_RVK
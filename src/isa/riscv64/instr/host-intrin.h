@@ -0,0 +1,42 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV64_HOST_INTRIN_H__
+#define __RISCV64_HOST_INTRIN_H__
+
+// RVB/RVK instructions implemented with host instructions.
+// init_host_intrin() enables the ones supported by the host CPU and
+// matching the C versions in rvb/rvintrin.h and rvk/crypto_impl.h,
+// which are used otherwise.
+typedef struct {
+  bool popcnt, pclmul, ssse3, aes;
+} HostIntrin;
+
+extern HostIntrin host_intrin;
+
+uint64_t host_cpop  (uint64_t rs1);
+uint64_t host_cpopw (uint64_t rs1);
+uint64_t host_clmul (uint64_t rs1, uint64_t rs2);
+uint64_t host_clmulh(uint64_t rs1, uint64_t rs2);
+uint64_t host_clmulr(uint64_t rs1, uint64_t rs2);
+uint64_t host_xpermb(uint64_t rs1, uint64_t rs2);
+
+uint64_t host_aes64es (uint64_t rs1, uint64_t rs2);
+uint64_t host_aes64esm(uint64_t rs1, uint64_t rs2);
+uint64_t host_aes64ds (uint64_t rs1, uint64_t rs2);
+uint64_t host_aes64dsm(uint64_t rs1, uint64_t rs2);
+uint64_t host_aes64im (uint64_t rs1);
+
+#endif
@@ -67,6 +67,7 @@ def_EHelper(p_jal) {
   br_log[br_count].type = 1;
   br_count++;
 #endif // CONFIG_BR_LOG
+  rtl_ras_push(s);
   rtl_j(s, id_src1->imm);
 }
 
@@ -78,7 +79,7 @@ def_EHelper(p_ret) {
 #else
 //  IFDEF(CONFIG_ENGINE_INTERPRETER, rtl_andi(s, s0, s0, ~0x1u));
   IFNDEF(CONFIG_DIFFTEST_REF_NEMU, difftest_skip_dut(1, 2));
-  rtl_jr(s, &cpu.gpr[1]._64);
+  rtl_ret(s, &cpu.gpr[1]._64);
 #endif // CONFIG_SHARE
 }
 
@@ -16,9 +16,76 @@
 
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/host-tlb.h>
 #include <rtl/rtl.h>
 #include "../local-include/intr.h"
 
+#if defined(CONFIG_USER_THREADS) || (defined(CONFIG_MODE_SYSTEM) && !defined(CONFIG_SHARE))
+// AMOs on pmem are performed with host atomic instructions, so they stay
+// atomic when harts or guest threads are not simulated by a single host thread.
+#define AMO_HOST_ATOMIC
+#ifdef CONFIG_MODE_USER
+#include <sys/mman.h>
+#endif
+
+#define def_amo_host(bits) \
+static inline uint##bits##_t amo_host##bits(uint##bits##_t *p, uint32_t funct5, uint##bits##_t src) { \
+  switch (funct5) { \
+    case 0b00001: return __atomic_exchange_n(p, src, __ATOMIC_SEQ_CST); \
+    case 0b00000: return __atomic_fetch_add(p, src, __ATOMIC_SEQ_CST); \
+    case 0b01000: return __atomic_fetch_or (p, src, __ATOMIC_SEQ_CST); \
+    case 0b01100: return __atomic_fetch_and(p, src, __ATOMIC_SEQ_CST); \
+    case 0b00100: return __atomic_fetch_xor(p, src, __ATOMIC_SEQ_CST); \
+  } \
+  /* min and max have no host instructions, retry with compare-and-swap */ \
+  uint##bits##_t old = __atomic_load_n(p, __ATOMIC_RELAXED), new; \
+  do { \
+    switch (funct5) { \
+      case 0b10000: new = ((int##bits##_t)old < (int##bits##_t)src ? old : src); break; \
+      case 0b10100: new = ((int##bits##_t)old > (int##bits##_t)src ? old : src); break; \
+      case 0b11000: new = (old < src ? old : src); break; \
+      case 0b11100: new = (old > src ? old : src); break; \
+      default: assert(0); \
+    } \
+  } while (!__atomic_compare_exchange_n(p, &old, new, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)); \
+  return old; \
+}
+
+def_amo_host(32)
+def_amo_host(64)
+
+// Return the host address for an AMO, or NULL to take the slow path,
+// which also raises the exceptions. The address is writable if it hits
+// the write entries of host TLB, or it is pmem passing the PMP check.
+// PMP has no write-only regions (W=1, R=0 is reserved), so checking
+// the write permission is enough.
+static inline void *amo_host_addr(vaddr_t vaddr, int width) {
+  if (vaddr & (width - 1)) return NULL;
+#ifdef CONFIG_MODE_USER
+  // guest addresses are host addresses, but the host may map more than the guest
+  if (!user_access_ok(vaddr, width, PROT_READ | PROT_WRITE)) return NULL;
+  return guest_to_host(vaddr);
+#else
+  int mmu_mode = isa_mmu_check(vaddr, width, MEM_TYPE_WRITE);
+  if (mmu_mode == MMU_DIRECT) {
+    if (!in_pmem(vaddr) || !isa_pmp_check_permission(vaddr, width, MEM_TYPE_WRITE, cpu.mode)) return NULL;
+    return guest_to_host(vaddr);
+  }
+#ifdef CONFIG_PERF_OPT
+  if (mmu_mode == MMU_TRANSLATE) {
+#ifdef CONFIG_RVH
+    extern bool has_two_stage_translation();
+    if (has_two_stage_translation()) return NULL;
+#endif // CONFIG_RVH
+    return hosttlb_lookup_write(vaddr);
+  }
+#endif // CONFIG_PERF_OPT
+  return NULL;
+#endif // CONFIG_MODE_USER
+}
+#endif
+
 __attribute__((cold))
 def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src2) {
   uint32_t funct5 = s->isa.instr.r.funct7 >> 2;
@@ -29,6 +96,14 @@ def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src
     cpu.lr_addr = *src1;
     cpu.lr_valid = 1;
     rtl_lms(s, dest, src1, 0, width, MMU_DYNAMIC);
+    cpu.lr_value = *dest;
+#ifdef CONFIG_HART_CONTEXT
+    // stores from other harts are seen in physical addresses
+    cpu.lr_paddr = *src1;
+    if (isa_mmu_check(*src1, width, MEM_TYPE_READ) == MMU_TRANSLATE) {
+      cpu.lr_paddr = (isa_mmu_translate(*src1, width, MEM_TYPE_READ) & ~PAGE_MASK) | (*src1 & PAGE_MASK);
+    }
+#endif
     return;
   } else if (funct5 == 0b00011) { // sc
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
@@ -41,6 +116,18 @@ def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src
     int success = cpu.lr_addr == *src1 && cpu.lr_valid;
     cpu.lr_valid = 0;
     if (success) {
+#ifdef AMO_HOST_ATOMIC
+      // succeed only if the reserved value is not changed by other threads
+      void *host = amo_host_addr(*src1, width);
+      if (host != NULL) {
+        success = (width == 8 ?
+            __atomic_compare_exchange_n((uint64_t *)host, &(uint64_t){cpu.lr_value}, *src2,
+              false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) :
+            __atomic_compare_exchange_n((uint32_t *)host, &(uint32_t){cpu.lr_value}, *src2,
+              false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+        if (success) pmem_reservation_hook(host_to_guest(host), width);
+      } else
+#endif // AMO_HOST_ATOMIC
       rtl_sm(s, src2, src1, 0, width, MMU_DYNAMIC);
     } else {
       cpu.lr_valid = 0;
@@ -65,6 +152,17 @@ def_rtl(amo_slow_path, rtlreg_t *dest, const rtlreg_t *src1, const rtlreg_t *src
   }
 
   cpu.amo = true;
+#ifdef AMO_HOST_ATOMIC
+  void *host = amo_host_addr(*src1, width);
+  if (host != NULL) {
+    pmem_reservation_hook(host_to_guest(host), width);
+    word_t old = (width == 8 ? amo_host64(host, funct5, *src2) :
+        (sword_t)(int32_t)amo_host32(host, funct5, *src2));
+    rtl_mv(s, dest, &old);
+    cpu.amo = false;
+    return;
+  }
+#endif // AMO_HOST_ATOMIC
   rtl_lms(s, s0, src1, 0, width, MMU_DYNAMIC);
   switch (funct5) {
     case 0b00001: rtl_mv (s, s1, src2); break;
@@ -15,6 +15,7 @@
 
 #ifdef CONFIG_RVB
 #include "rvintrin.h"
+#include "../host-intrin.h"
 
 def_EHelper(clz) {
   *ddest = _rv_clz(*dsrc1);
@@ -25,7 +26,7 @@ def_EHelper(ctz) {
 }
 
 def_EHelper(cpop) {
-  *ddest = _rv_cpop(*dsrc1);
+  *ddest = host_intrin.popcnt ? host_cpop(*dsrc1) : _rv_cpop(*dsrc1);
 }
 
 def_EHelper(sext_b) {
@@ -61,7 +62,7 @@ def_EHelper(ctzw) {
 }
 
 def_EHelper(cpopw) {
-  *ddest = _rv32_cpop(*dsrc1);
+  *ddest = host_intrin.popcnt ? host_cpopw(*dsrc1) : _rv32_cpop(*dsrc1);
 }
 
 def_EHelper(andn) {
@@ -133,15 +134,15 @@ def_EHelper(bexti) {
 }
 
 def_EHelper(clmul) {
-  *ddest = _rv_clmul(*dsrc1, *dsrc2);
+  *ddest = host_intrin.pclmul ? host_clmul(*dsrc1, *dsrc2) : _rv_clmul(*dsrc1, *dsrc2);
 }
 
 def_EHelper(clmulr) {
-  *ddest = _rv_clmulr(*dsrc1, *dsrc2);
+  *ddest = host_intrin.pclmul ? host_clmulr(*dsrc1, *dsrc2) : _rv_clmulr(*dsrc1, *dsrc2);
 }
 
 def_EHelper(clmulh) {
-  *ddest = _rv_clmulh(*dsrc1, *dsrc2);
+  *ddest = host_intrin.pclmul ? host_clmulh(*dsrc1, *dsrc2) : _rv_clmulh(*dsrc1, *dsrc2);
 }
 
 def_EHelper(min) {
@@ -178,7 +179,7 @@ def_EHelper(xpermn) {
 }
 
 def_EHelper(xpermb) {
-  *ddest = _rv_xpermb(*dsrc1, *dsrc2);
+  *ddest = host_intrin.ssse3 ? host_xpermb(*dsrc1, *dsrc2) : _rv_xpermb(*dsrc1, *dsrc2);
 }
 
 def_EHelper(adduw) {
@@ -55,7 +55,9 @@ def_EHelper(c_jr) {
 }
 
 def_EHelper(c_jalr) {
+  difftest_mark_reg(&cpu.gpr[1]);
   rtl_li(s, &cpu.gpr[1]._64, s->snpc);
+  rtl_ras_push(s);
 #ifdef CONFIG_SHARE
   // See rvi/control.h:26. JALR should set the LSB to 0.
   rtl_andi(s, s0, dsrc1, ~1UL);
@@ -18,6 +18,25 @@ bool fp_enable();
 static int table_op_fp_d(Decode *s);
 static int table_fmadd_d_dispatch(Decode *s);
 
+// rm = 5 and 6 are reserved. They are rejected at decode time,
+// so isa_fp_get_rm() needs no check at execution.
+static inline bool fp_rm_illegal(Decode *s) {
+  uint32_t rm = s->isa.instr.fp.rm;
+  return rm == 5 || rm == 6;
+}
+
+static inline bool op_fp_has_rm(Decode *s) {
+  switch (s->isa.instr.fp.funct5) {
+    case 0b00100: // fsgnj
+    case 0b00101: // fmin, fmax
+    case 0b10100: // feq, flt, fle
+    case 0b11100: // fmv.x, fclass
+    case 0b11110: // fmv.?.x
+      return false;
+    default: return true;
+  }
+}
+
 static inline def_DopHelper(fr){
   op->preg = &fpreg_l(val);
   print_Dop(op->str, OP_STR_SIZE, "%s", fpreg_name(val, 4));
@@ -201,6 +220,7 @@ def_THelper(fstore) {
 def_THelper(op_fp) {
 #ifndef CONFIG_FPU_NONE
   if (!fp_enable()) return table_rt_inv(s);
+  if (op_fp_has_rm(s) && fp_rm_illegal(s)) return table_rt_inv(s);
 
   if ((s->isa.instr.fp.fmt == 0b00 && s->isa.instr.fp.funct5 == 0b01000) ||
       s->isa.instr.fp.fmt == 0b01) return table_op_fp_d(s);
@@ -240,6 +260,7 @@ def_THelper(op_fp) {
 def_THelper(fmadd_dispatch) {
 #ifndef CONFIG_FPU_NONE
   if (!fp_enable()) return table_rt_inv(s);
+  if (fp_rm_illegal(s)) return table_rt_inv(s);
   def_INSTR_TAB("????? 01 ????? ????? ??? ????? ????? ??", fmadd_d_dispatch);
 
   def_INSTR_TAB("????? 00 ????? ????? ??? ????? 10000 ??", fmadds);
@@ -47,6 +47,7 @@ def_EHelper(jalr) {
   rtl_li(s, ddest, s->snpc);
 #endif
   IFNDEF(CONFIG_DIFFTEST_REF_NEMU, difftest_skip_dut(1, 3));
+  if (ddest == &cpu.gpr[1]._64) rtl_ras_push(s);
   rtl_jr(s, s0);
   //printf("%lx,%lx,%d,%d,%lx\n", br_count, cpu.pc, 1, 1, *s0);
 }
@@ -18,18 +18,36 @@
     concat(rtl_, rtl_instr) (s, ddest, dsrc1, id_src2->imm, width, mmu_mode); \
   }
 
-#define def_all_ldst(suffix, mmu_mode) \
-  def_ldst_template(concat(ld , suffix), lms, 8, mmu_mode) \
-  def_ldst_template(concat(lw , suffix), lms, 4, mmu_mode) \
-  def_ldst_template(concat(lh , suffix), lms, 2, mmu_mode) \
-  def_ldst_template(concat(lb , suffix), lms, 1, mmu_mode) \
-  def_ldst_template(concat(lwu, suffix), lm , 4, mmu_mode) \
-  def_ldst_template(concat(lhu, suffix), lm , 2, mmu_mode) \
-  def_ldst_template(concat(lbu, suffix), lm , 1, mmu_mode) \
-  def_ldst_template(concat(sd , suffix), sm , 8, mmu_mode) \
-  def_ldst_template(concat(sw , suffix), sm , 4, mmu_mode) \
-  def_ldst_template(concat(sh , suffix), sm , 2, mmu_mode) \
-  def_ldst_template(concat(sb , suffix), sm , 1, mmu_mode)
+// Page faults of the accesses with address translation are delivered by
+// execute() without longjmp(), see raise_exception() in cpu-exec.c.
+// A faulting load must leave rd untouched, so it loads to s0 first.
+#define def_ld_ex_return_template(name, rtl_instr, width, mmu_mode) \
+  def_EHelper(name) { \
+    rtl_ex_return_begin(s); \
+    concat(rtl_, rtl_instr) (s, s0, dsrc1, id_src2->imm, width, mmu_mode); \
+    rtl_ex_return_end(s); \
+    rtl_mv(s, ddest, s0); \
+  }
+
+#define def_st_ex_return_template(name, rtl_instr, width, mmu_mode) \
+  def_EHelper(name) { \
+    rtl_ex_return_begin(s); \
+    concat(rtl_, rtl_instr) (s, ddest, dsrc1, id_src2->imm, width, mmu_mode); \
+    rtl_ex_return_end(s); \
+  }
+
+#define def_all_ldst(suffix, ld_template, st_template, mmu_mode) \
+  ld_template(concat(ld , suffix), lms, 8, mmu_mode) \
+  ld_template(concat(lw , suffix), lms, 4, mmu_mode) \
+  ld_template(concat(lh , suffix), lms, 2, mmu_mode) \
+  ld_template(concat(lb , suffix), lms, 1, mmu_mode) \
+  ld_template(concat(lwu, suffix), lm , 4, mmu_mode) \
+  ld_template(concat(lhu, suffix), lm , 2, mmu_mode) \
+  ld_template(concat(lbu, suffix), lm , 1, mmu_mode) \
+  st_template(concat(sd , suffix), sm , 8, mmu_mode) \
+  st_template(concat(sw , suffix), sm , 4, mmu_mode) \
+  st_template(concat(sh , suffix), sm , 2, mmu_mode) \
+  st_template(concat(sb , suffix), sm , 1, mmu_mode)
 
-def_all_ldst(, MMU_DIRECT)
-def_all_ldst(_mmu, MMU_TRANSLATE)
+def_all_ldst(, def_ldst_template, def_ldst_template, MMU_DIRECT)
+def_all_ldst(_mmu, def_ld_ex_return_template, def_st_ex_return_template, MMU_TRANSLATE)
@@ -16,25 +16,26 @@
 #ifdef CONFIG_RVK
 
 #include "crypto_impl.h"
+#include "../host-intrin.h"
 
 def_EHelper(aes64es) {
-  *ddest = aes64es(*dsrc1, *dsrc2);
+  *ddest = host_intrin.aes ? host_aes64es(*dsrc1, *dsrc2) : aes64es(*dsrc1, *dsrc2);
 }
 
 def_EHelper(aes64esm) {
-  *ddest = aes64esm(*dsrc1, *dsrc2);
+  *ddest = host_intrin.aes ? host_aes64esm(*dsrc1, *dsrc2) : aes64esm(*dsrc1, *dsrc2);
 }
 
 def_EHelper(aes64ds) {
-  *ddest = aes64ds(*dsrc1, *dsrc2);
+  *ddest = host_intrin.aes ? host_aes64ds(*dsrc1, *dsrc2) : aes64ds(*dsrc1, *dsrc2);
 }
 
 def_EHelper(aes64dsm) {
-  *ddest = aes64dsm(*dsrc1, *dsrc2);
+  *ddest = host_intrin.aes ? host_aes64dsm(*dsrc1, *dsrc2) : aes64dsm(*dsrc1, *dsrc2);
 }
 
 def_EHelper(aes64im) {
-  *ddest = aes64im(*dsrc1);
+  *ddest = host_intrin.aes ? host_aes64im(*dsrc1) : aes64im(*dsrc1);
 }
 
 def_EHelper(aes64ks1i) {
@@ -40,6 +40,9 @@ int get_mode(Decode *s) {
 void set_vtype_vl(Decode *s, int mode) {
   rtlreg_t vl_num = check_vsetvl(id_src2->val, id_src1->val, mode);
   rtlreg_t error = 1ul << 63;
+  difftest_mark_csr(vtype);
+  difftest_mark_csr(vl);
+  difftest_mark_csr(vstart);
   
   if(vl_num == (uint64_t)-1) {
     vtype->val = error;
@@ -27,7 +27,122 @@
 #define s2    (&tmp_reg[2])
 #define s3    (&tmp_reg[3])
 
+// Fast path of the element-wise instructions without widening, narrowing
+// and mask destination. The whole register group is computed with host
+// vectors, which are lowered to SIMD instructions when the host has them,
+// then the body elements are committed in bulk with v0 as a bit vector.
+
+#define VGROUP_BYTES (VLEN / 8 * 8) // LMUL <= 8
+
+#define vblend(m, x, y) (((vu)(m) & (x)) | (~(vu)(m) & (y)))
+
+#define def_varith_kernel(bits) \
+static void concat(varith_kernel, bits)(int opcode, void *res, const void *vs2, \
+    const void *vs1, uint64_t x, int nr) { \
+  typedef concat3(uint, bits, _t) vu __attribute__((vector_size(VLEN / 8))); \
+  typedef concat3(int, bits, _t) vs __attribute__((vector_size(VLEN / 8))); \
+  vu vx = (vu){} + (concat3(uint, bits, _t))x; \
+  for (int r = 0; r < nr; r ++) { \
+    vu a, b = vx, d; \
+    memcpy(&a, vs2 + r * sizeof(vu), sizeof(vu)); \
+    if (vs1 != NULL) memcpy(&b, vs1 + r * sizeof(vu), sizeof(vu)); \
+    switch (opcode) { \
+      case ADD  : d = a + b; break; \
+      case SUB  : d = a - b; break; \
+      case RSUB : d = b - a; break; \
+      case AND  : d = a & b; break; \
+      case OR   : d = a | b; break; \
+      case XOR  : d = a ^ b; break; \
+      case MUL  : d = a * b; break; \
+      case MINU : d = vblend(a < b, a, b); break; \
+      case MAXU : d = vblend(a > b, a, b); break; \
+      case MIN  : d = vblend((vs)a < (vs)b, a, b); break; \
+      case MAX  : d = vblend((vs)a > (vs)b, a, b); break; \
+      case SLL  : d = a << (b & (bits - 1)); break; \
+      case SRL  : d = a >> (b & (bits - 1)); break; \
+      case SRA  : d = (vu)((vs)a >> (vs)(b & (bits - 1))); break; \
+      case MERGE: d = b; break; \
+      default: assert(0); \
+    } \
+    memcpy(res + r * sizeof(vu), &d, sizeof(vu)); \
+  } \
+}
+
+def_varith_kernel(8)
+def_varith_kernel(16)
+def_varith_kernel(32)
+def_varith_kernel(64)
+
+static bool arthimetic_fast(int opcode, int is_signed, Decode *s) {
+  switch (opcode) {
+    case ADD: case SUB: case RSUB: case AND: case OR: case XOR: case MUL:
+    case MINU: case MAXU: case MIN: case MAX: case SLL: case SRL: case SRA:
+    case MERGE: break;
+    default: return false;
+  }
+  int vsew = vtype->vsew, vlmul = vtype->vlmul;
+  if (vsew > 3 || vlmul > 3) return false;
+  // misaligned register groups are reported by the slow path
+  int align = (1 << vlmul) - 1;
+  if ((id_dest->reg & align) || (id_src2->reg & align) ||
+      (s->src_vmode == SRC_VV && (id_src->reg & align))) return false;
+
+  uint64_t x = 0;
+  switch (s->src_vmode) {
+    case SRC_VX:
+      rtl_lr(s, &(id_src->val), id_src1->reg, 4);
+      x = id_src->val;
+      break;
+    case SRC_VI:
+      x = is_signed ? s->isa.instr.v_opv2.v_simm5 : s->isa.instr.v_opv3.v_imm5;
+      break;
+  }
+
+  uint8_t res[VGROUP_BYTES];
+  const uint8_t *vs2 = cpu.vr[id_src2->reg]._8;
+  const uint8_t *vs1 = (s->src_vmode == SRC_VV ? cpu.vr[id_src->reg]._8 : NULL);
+  int nr = 1 << vlmul;
+  switch (vsew) {
+    case 0: varith_kernel8 (opcode, res, vs2, vs1, x, nr); break;
+    case 1: varith_kernel16(opcode, res, vs2, vs1, x, nr); break;
+    case 2: varith_kernel32(opcode, res, vs2, vs1, x, nr); break;
+    case 3: varith_kernel64(opcode, res, vs2, vs1, x, nr); break;
+  }
+
+  // commit the body elements, tail elements are left undisturbed
+  uint8_t *vd = cpu.vr[id_dest->reg]._8;
+  difftest_mark_vreg(id_dest->reg, nr);
+  int esz = 1 << vsew;
+  uint64_t start = vstart->val, end = vl->val;
+  if (start < end) {
+    if (s->vm) {
+      memcpy(vd + start * esz, res + start * esz, (end - start) * esz);
+    } else {
+      // the mask is read before vd is written, since vd may overlap v0
+      uint64_t mask[VENUM64];
+      memcpy(mask, cpu.vr[0]._64, sizeof(mask));
+      // merge takes vs2 for the masked-off elements
+      if (opcode == MERGE) memmove(vd + start * esz, vs2 + start * esz, (end - start) * esz);
+      for (uint64_t w = start / 64; w <= (end - 1) / 64; w ++) {
+        uint64_t m = mask[w];
+        if (w == start / 64) m &= ~0ull << (start % 64);
+        if (w == (end - 1) / 64 && end % 64 != 0) m &= ~(~0ull << (end % 64));
+        for (; m != 0; m &= m - 1) {
+          uint64_t idx = w * 64 + __builtin_ctzll(m);
+          memcpy(vd + idx * esz, res + idx * esz, esz);
+        }
+      }
+    }
+  }
+
+  rtl_li(s, s0, 0);
+  vcsr_write(IDXVSTART, s0);
+  return true;
+}
+
 void arthimetic_instr(int opcode, int is_signed, int widening, int narrow, int dest_mask, Decode *s) {
+  if (!widening && !narrow && !dest_mask && arthimetic_fast(opcode, is_signed, s)) return;
+
   int vlmax = get_vlmax(vtype->vsew, vtype->vlmul);
   int idx;
   for(idx = vstart->val; idx < vl->val; idx ++) {
@@ -62,7 +177,9 @@ void arthimetic_instr(int opcode, int is_signed, int widening, int narrow, int d
       case SRC_VX :   
         rtl_lr(s, &(id_src->val), id_src1->reg, 4);
         rtl_mv(s, s1, &id_src->val); 
+        // rs1 is truncated to SEW bits, as in arthimetic_fast()
         if(is_signed) rtl_sext(s, s1, s1, 1 << vtype->vsew);
+        else rtl_zext(s, s1, s1, 1 << vtype->vsew);
         break;
       case SRC_VI :
         if(is_signed) rtl_li(s, s1, s->isa.instr.v_opv2.v_simm5);
@@ -17,6 +17,136 @@
 #ifdef CONFIG_RVV
 
 #include "vldst_impl.h"
+#include <memory/host.h>
+#include <memory/paddr.h>
+#include <memory/host-tlb.h>
+
+// Host address of [vaddr, vaddr + len) for a vector access, which is in one
+// page, or NULL to access it element by element through the normal path,
+// which also raises the exceptions. *page_valid is set if the host address is
+// valid for the whole page, so that the next accesses to it need no lookup.
+static uint8_t *vldst_host_addr(vaddr_t vaddr, int len, int type, int mmu_mode, bool *page_valid) {
+  *page_valid = false;
+#ifdef CONFIG_MODE_USER
+  // guest addresses are host addresses
+  *page_valid = true;
+  return guest_to_host(vaddr);
+#else
+#ifdef CONFIG_SHARE
+  // stores are recorded by the store commit queue of paddr_write()
+  if (type == MEM_TYPE_WRITE) return NULL;
+#endif
+  if (mmu_mode == MMU_DYNAMIC) mmu_mode = isa_mmu_check(vaddr, len, type);
+  if (mmu_mode == MMU_DIRECT) {
+    if (!in_pmem(vaddr) || !in_pmem(vaddr + len - 1) ||
+        !isa_pmp_check_permission(vaddr, len, type, cpu.mode)) return NULL;
+    return guest_to_host(vaddr);
+  }
+#ifdef CONFIG_PERF_OPT
+  if (mmu_mode == MMU_TRANSLATE) {
+#ifdef CONFIG_RVH
+    extern bool has_two_stage_translation();
+    if (has_two_stage_translation()) return NULL;
+#endif // CONFIG_RVH
+    // entries of host TLB are valid for the whole page
+    uint8_t *host = (type == MEM_TYPE_WRITE ? hosttlb_lookup_write : hosttlb_lookup_read)(vaddr);
+    *page_valid = (host != NULL);
+    return host;
+  }
+#endif // CONFIG_PERF_OPT
+  return NULL;
+#endif // CONFIG_MODE_USER
+}
+
+static inline void vldst_write_hook(uint8_t *host, int len) {
+  IFDEF(CONFIG_MODE_SYSTEM, pmem_snapshot_hook(host_to_guest(host), len));
+  IFDEF(CONFIG_MODE_SYSTEM, pmem_reservation_hook(host_to_guest(host), len));
+}
+
+// Unit-stride accesses without extension are copied between memory and the
+// register group in runs of elements within a page, each with a single
+// translation. The elements across pages go through the normal path.
+static void vldst_unit(Decode *s, bool is_load, int mmu_mode) {
+  int esz = s->v_width;
+  int type = is_load ? MEM_TYPE_READ : MEM_TYPE_WRITE;
+  uint8_t *vreg = cpu.vr[id_dest->reg]._8;
+  if (is_load) difftest_mark_vreg(id_dest->reg, 1 << vtype->vlmul);
+  // the mask is read before the loads, since vd may overlap v0
+  uint64_t mask[VENUM64];
+  memcpy(mask, cpu.vr[0]._64, sizeof(mask));
+  // misaligned elements raise exceptions in the normal path
+  bool misaligned = ISDEF(CONFIG_AC_SOFT) && (s->src1.val & (esz - 1)) != 0;
+  word_t idx = vstart->val;
+  while (idx < vl->val) {
+    vaddr_t addr = s->src1.val + idx * esz;
+    word_t n = (PAGE_SIZE - (addr & PAGE_MASK)) / esz;
+    if (n > vl->val - idx) n = vl->val - idx;
+    bool page_valid;
+    uint8_t *host = (n == 0 || misaligned ? NULL : vldst_host_addr(addr, n * esz, type, mmu_mode, &page_valid));
+    if (host == NULL) {
+      // access one element through the normal path, which fills the host TLB for its page
+      if (s->vm != 0 || (mask[idx / 64] >> (idx % 64) & 1)) {
+        rtl_li(s, &tmp_reg[0], addr);
+        if (is_load) {
+          rtl_lm(s, &tmp_reg[1], &tmp_reg[0], 0, esz, mmu_mode);
+          set_vreg(id_dest->reg, idx, tmp_reg[1], vtype->vsew, vtype->vlmul, 1);
+        } else {
+          get_vreg(id_dest->reg, idx, &tmp_reg[1], vtype->vsew, vtype->vlmul, 0, 1);
+          rtl_sm(s, &tmp_reg[1], &tmp_reg[0], 0, esz, mmu_mode);
+        }
+      }
+      idx ++;
+      continue;
+    }
+
+    if (s->vm != 0) {
+      if (is_load) memcpy(vreg + idx * esz, host, n * esz);
+      else {
+        vldst_write_hook(host, n * esz);
+        memcpy(host, vreg + idx * esz, n * esz);
+      }
+    } else {
+      for (word_t i = idx; i < idx + n; i ++) {
+        if (!(mask[i / 64] >> (i % 64) & 1)) continue;
+        uint8_t *h = host + (i - idx) * esz;
+        if (is_load) memcpy(vreg + i * esz, h, esz);
+        else {
+          vldst_write_hook(h, esz);
+          memcpy(h, vreg + i * esz, esz);
+        }
+      }
+    }
+    idx += n;
+  }
+  difftest_mark_csr(vstart);
+  vstart->val = 0;
+}
+
+static inline bool vldst_unit_fast(int mode, Decode *s) {
+  // misaligned register groups are reported by set_vreg()/get_vreg()
+  return mode == MODE_UNIT && s->v_width == (1 << vtype->vsew) && vtype->vlmul <= 3 &&
+    (id_dest->reg & ((1 << vtype->vlmul) - 1)) == 0;
+}
+
+// Strided and indexed accesses keep the host address of the last page, so
+// that the elements in the same page need no translation.
+typedef struct {
+  vaddr_t vpn;
+  uint8_t *offset;
+} VldstPage;
+
+static inline uint8_t *vldst_page_host(VldstPage *pg, vaddr_t addr, int len, int type, int mmu_mode) {
+  if ((addr & PAGE_MASK) + len > PAGE_SIZE) return NULL;
+  if (ISDEF(CONFIG_AC_SOFT) && (addr & (len - 1)) != 0) return NULL;
+  if ((addr >> PAGE_SHIFT) == pg->vpn) return pg->offset + addr;
+  bool page_valid;
+  uint8_t *host = vldst_host_addr(addr, len, type, mmu_mode, &page_valid);
+  if (page_valid) {
+    pg->vpn = addr >> PAGE_SHIFT;
+    pg->offset = host - addr;
+  }
+  return host;
+}
 
 void vld(int mode, int is_signed, Decode *s, int mmu_mode) {
   //TODO: raise instr when decinfo.v_width > SEW
@@ -33,6 +163,12 @@ void vld(int mode, int is_signed, Decode *s, int mmu_mode) {
   // previous decode does not load vals for us 
   rtl_lr(s, &(s->src1.val), s->src1.reg, 4);
 
+  if (vldst_unit_fast(mode, s)) {
+    vldst_unit(s, true, mmu_mode);
+    return;
+  }
+
+  VldstPage pg = { .vpn = -1 };
   word_t idx;
   rtl_mv(s, &(tmp_reg[0]), &(s->src1.val));
   for(idx = vstart->val; idx < vl->val; idx ++) {
@@ -49,7 +185,9 @@ void vld(int mode, int is_signed, Decode *s, int mmu_mode) {
     
     // op
     if(s->vm != 0 || mask != 0) {
-      rtl_lm(s, &tmp_reg[1], &tmp_reg[0], 0, s->v_width, mmu_mode);
+      uint8_t *host = vldst_page_host(&pg, tmp_reg[0], s->v_width, MEM_TYPE_READ, mmu_mode);
+      if (host != NULL) tmp_reg[1] = host_read(host, s->v_width);
+      else rtl_lm(s, &tmp_reg[1], &tmp_reg[0], 0, s->v_width, mmu_mode);
       if (is_signed) rtl_sext(s, &tmp_reg[1], &tmp_reg[1], s->v_width);
       
       set_vreg(id_dest->reg, idx, *&tmp_reg[1], vtype->vsew, vtype->vlmul, 1);
@@ -62,6 +200,7 @@ void vld(int mode, int is_signed, Decode *s, int mmu_mode) {
   }
 
   // TODO: the idx larger than vl need reset to zero.
+  difftest_mark_csr(vstart);
   vstart->val = 0;
 }
 
@@ -80,6 +219,12 @@ void vst(int mode, Decode *s, int mmu_mode) {
 
   rtl_lr(s, &(s->src1.val), s->src1.reg, 4);
 
+  if (vldst_unit_fast(mode, s)) {
+    vldst_unit(s, false, mmu_mode);
+    return;
+  }
+
+  VldstPage pg = { .vpn = -1 };
   word_t idx;
   rtl_mv(s, &(tmp_reg[0]), &(s->src1.val));
   for(idx = vstart->val; idx < vl->val; idx ++) {
@@ -117,7 +262,12 @@ void vst(int mode, Decode *s, int mmu_mode) {
       //   case 3 : rtl_li(&&tmp_reg[1], vreg_l(id_dest->reg, idx)); break;
       // }
       get_vreg(id_dest->reg, idx, &tmp_reg[1], vtype->vsew, vtype->vlmul, 0, 1);
-      rtl_sm(s, &tmp_reg[1], &tmp_reg[0], 0, s->v_width, mmu_mode);
+      uint8_t *host = vldst_page_host(&pg, tmp_reg[0], s->v_width, MEM_TYPE_WRITE, mmu_mode);
+      if (host != NULL) {
+        vldst_write_hook(host, s->v_width);
+        host_write(host, s->v_width, tmp_reg[1]);
+      }
+      else rtl_sm(s, &tmp_reg[1], &tmp_reg[0], 0, s->v_width, mmu_mode);
     }
 
     switch (mode) {
@@ -126,6 +276,7 @@ void vst(int mode, Decode *s, int mmu_mode) {
     }
   }
   // TODO: the idx larger than vl need reset to zero.
+  difftest_mark_csr(vstart);
   vstart->val = 0;
 }
 
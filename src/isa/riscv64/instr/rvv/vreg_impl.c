@@ -18,6 +18,7 @@
 
 #include "vreg.h"
 #include "../local-include/csr.h"
+#include "../local-include/reg.h"
 #include <stdio.h>
 #include "isa.h"
 
@@ -63,6 +64,7 @@ rtlreg_t get_mask(int reg, int idx, uint64_t vsew, uint64_t vlmul) {
 void set_mask(uint32_t reg, int idx, uint64_t mask, uint64_t vsew, uint64_t vlmul) {
   int idx1 = idx / 64;
   int idx2 = idx % 64;
+  difftest_mark_vreg(reg, 1);
   //printf("set_mask: idx1 = %d, idx2 = %d, mask = %ld\n", idx1, idx2, mask);
   
   if (mask) {
@@ -109,6 +111,7 @@ void set_vreg(uint64_t reg, int idx, rtlreg_t src, uint64_t vsew, uint64_t vlmul
   if(needAlign) Assert(reg % (1 << vlmul) == 0, "vreg is not aligned\n");
   int new_reg = get_reg(reg, idx, vsew);
   int new_idx = get_idx(reg, idx, vsew);
+  difftest_mark_vreg(new_reg, 1);
 
   switch (vsew) {
     case 0 : src = src & 0xff; break;
@@ -37,7 +37,7 @@ def_EHelper(nemu_trap) {
       extern void disable_time_intr();
       disable_time_intr();
   } else if (cpu.gpr[10]._64 == 0x101) {
-      extern uint64_t g_nr_guest_instr;
+      extern GUEST_THREAD_LOCAL uint64_t g_nr_guest_instr;
       extern bool profiling_started;
 
       if (!profiling_started) {
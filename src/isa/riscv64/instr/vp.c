@@ -26,6 +26,7 @@ bool vp_enable() {
 
 void vp_set_dirty() {
   // lazily update
+  difftest_mark_csr(mstatus);
   mstatus->vs = 3;
 }
 #endif // CONFIG_RVV
\ No newline at end of file
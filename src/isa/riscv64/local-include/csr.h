@@ -816,7 +816,15 @@ CSR_STRUCT_START(vsatp)
 CSR_STRUCT_END(vsatp)
 #endif //CONFIG_RVH
 
+// addresses of all implemented CSRs
+extern const uint16_t csr_impl_addrs[];
+extern const int nr_csr_impl;
+
+#ifdef CONFIG_USER_THREADS
+#define CSRS_DECL(name, addr) extern __thread concat(name, _t)* name;
+#else
 #define CSRS_DECL(name, addr) extern concat(name, _t)* const name;
+#endif // CONFIG_USER_THREADS
 MAP(CSRS, CSRS_DECL)
 #ifdef CONFIG_RVV
   MAP(VCSRS, CSRS_DECL)
@@ -841,6 +849,24 @@ MAP(CSRS, CSRS_DECL)
 #define SSTATUS_RMASK (SSTATUS_WMASK | (0x3 << 15) | (1ull << 63) | (3ull << 32))
 word_t csrid_read(uint32_t csrid);
 
+#ifdef CONFIG_SHARE
+// CSRs written since the last delta sync, one bitmap for
+// isa_difftest_csrcpy_delta() and one for the CSR mirrors in
+// isa_difftest_regcpy_delta(). The write paths mark them with
+// difftest_mark_csr(), and difftest_mark_trap() marks the CSRs
+// and the mode changed by traps and trap returns.
+extern uint64_t csr_dirty[4096 / 64], csr_mirror_dirty[4096 / 64];
+#define difftest_mark_csr(name) do { \
+  int __addr = (rtlreg_t *)(name) - csr_array; \
+  csr_dirty[__addr / 64] |= 1ull << (__addr % 64); \
+  csr_mirror_dirty[__addr / 64] |= 1ull << (__addr % 64); \
+} while (0)
+void difftest_mark_trap();
+#else
+#define difftest_mark_csr(name)
+#define difftest_mark_trap()
+#endif // CONFIG_SHARE
+
 // PMP
 uint8_t pmpcfg_from_index(int idx);
 word_t pmpaddr_from_index(int idx);
@@ -41,4 +41,28 @@ static inline const char* fpreg_name(int index, int width){
   return fpregsl[index];
 }
 
+#ifdef CONFIG_SHARE
+// 64-bit words of the difftest register prefix written since the last delta
+// sync, see isa_difftest_regcpy_delta(). The CSR mirrors are marked through
+// difftest_mark_csr(), and the vector registers one bit per register.
+extern uint64_t reg_dirty[];
+#define difftest_mark_reg(p) do { \
+  uintptr_t __i = ((uintptr_t)(p) - (uintptr_t)&cpu) / sizeof(uint64_t); \
+  reg_dirty[__i / 64] |= 1ull << (__i % 64); \
+} while (0)
+// the destination operand of an instruction may not be a GPR or FPR
+#define difftest_mark_dest(p) do { \
+  uintptr_t __off = (uintptr_t)(p) - (uintptr_t)&cpu; \
+  if (__off < (uintptr_t)&cpu.mode - (uintptr_t)&cpu) reg_dirty[0] |= 1ull << (__off / sizeof(uint64_t)); \
+} while (0)
+#ifdef CONFIG_RVV
+extern uint32_t vreg_dirty;
+#define difftest_mark_vreg(reg, nr) (vreg_dirty |= ((1u << (nr)) - 1) << (reg))
+#endif // CONFIG_RVV
+#else
+#define difftest_mark_reg(p)
+#define difftest_mark_dest(p)
+#define difftest_mark_vreg(reg, nr)
+#endif // CONFIG_SHARE
+
 #endif
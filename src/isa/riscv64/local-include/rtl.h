@@ -53,7 +53,10 @@ static inline def_rtl(lr, rtlreg_t* dest, int r, int width) {
 }
 
 static inline def_rtl(sr, int r, const rtlreg_t *src1, int width) {
-  if (r != 0) { rtl_mv(s, &reg_l(r), src1); }
+  if (r != 0) {
+    difftest_mark_reg(&reg_l(r));
+    rtl_mv(s, &reg_l(r), src1);
+  }
 }
 
 #endif // CONFIG_RVV
@@ -0,0 +1,158 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Hart contexts for simulating several harts over one shared pmem.
+// The global cpu and csr_array always hold the selected hart, the others are
+// parked in their contexts, which only keep the implemented CSRs to make
+// switching cheap. Every hart has its own host TLB and tcache, so switching
+// does not flush them even if the next hart runs in another address space.
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/host-tlb.h>
+#include "../local-include/csr.h"
+#include "../local-include/trigger.h"
+#include "../local-include/hart.h"
+#include <stdlib.h>
+
+#ifdef CONFIG_HART_CONTEXT
+
+#ifdef CONFIG_PERF_OPT
+void tcache_select(int hart);
+#endif
+
+typedef struct {
+  CPU_state cpu;
+  rtlreg_t *csr;
+} HartContext;
+
+// reservation sets are cache lines, as in the DUT
+#define RESERVATION_SHIFT 6
+
+static HartContext *harts = NULL;
+static int nr_hart = 1, cur_hart = 0;
+static int mip_idx = -1;
+int nr_hart_reservation = 0; // parked harts holding a reservation
+
+static void hart_park(int id) {
+  HartContext *h = &harts[id];
+  h->cpu = cpu;
+  for (int i = 0; i < nr_csr_impl; i ++) {
+    h->csr[i] = csr_array[csr_impl_addrs[i]];
+  }
+  if (h->cpu.lr_valid) nr_hart_reservation ++;
+}
+
+static void hart_unpark(int id) {
+  HartContext *h = &harts[id];
+  cpu = h->cpu;
+  for (int i = 0; i < nr_csr_impl; i ++) {
+    csr_array[csr_impl_addrs[i]] = h->csr[i];
+  }
+  if (cpu.lr_valid) nr_hart_reservation --;
+}
+
+// all harts start from the current state, which should be the reset state
+void init_hart(int n) {
+  assert(harts == NULL && n >= 1);
+  harts = calloc(n, sizeof(HartContext));
+  assert(harts);
+  for (int i = 0; i < nr_csr_impl; i ++) {
+    if (csr_impl_addrs[i] == (rtlreg_t *)mip - csr_array) mip_idx = i;
+  }
+  assert(mip_idx != -1);
+
+  for (int i = 0; i < n; i ++) {
+    harts[i].csr = malloc(sizeof(rtlreg_t) * nr_csr_impl);
+    assert(harts[i].csr);
+    mhartid->val = i;
+    hart_park(i);
+#ifdef CONFIG_RVSDTRIG
+    if (i > 0) {
+      harts[i].cpu.TM = malloc(sizeof(TriggerModule));
+      *harts[i].cpu.TM = *cpu.TM;
+    }
+#endif // CONFIG_RVSDTRIG
+  }
+  nr_hart = n;
+  cur_hart = 0;
+  hart_unpark(0);
+  hosttlb_select(0);
+  IFDEF(CONFIG_PERF_OPT, tcache_select(0));
+}
+
+int hart_id() {
+  return cur_hart;
+}
+
+int hart_nr() {
+  return nr_hart;
+}
+
+// returns true if another hart is selected
+bool hart_switch(int id) {
+  assert(id >= 0 && id < nr_hart);
+  if (id == cur_hart) return false;
+#ifdef CONFIG_FPU_SOFT_HOST
+  void fp_host_sync();
+  fp_host_sync();
+#endif
+  hart_park(cur_hart);
+  hart_unpark(id);
+  cur_hart = id;
+  hosttlb_select(id);
+  IFDEF(CONFIG_PERF_OPT, tcache_select(id));
+
+  // recompute the states cached from CSRs
+  extern void update_mmu_state();
+  update_mmu_state();
+#ifndef CONFIG_FPU_NONE
+  void fp_update_rm_cache(uint32_t rm);
+  fp_update_rm_cache(fcsr->frm);
+#endif // CONFIG_FPU_NONE
+  return true;
+}
+
+mip_t *hart_mip(int id) {
+  return id == cur_hart ? mip : (mip_t *)&harts[id].csr[mip_idx];
+}
+
+void hart_reservation_kill(paddr_t addr, size_t len) {
+  for (int i = 0; i < nr_hart; i ++) {
+    CPU_state *c = &harts[i].cpu;
+    if (i == cur_hart || !c->lr_valid) continue;
+    uint64_t line = c->lr_paddr >> RESERVATION_SHIFT;
+    if (line >= (addr >> RESERVATION_SHIFT) && line <= ((addr + len - 1) >> RESERVATION_SHIFT)) {
+      c->lr_valid = 0;
+      nr_hart_reservation --;
+    }
+  }
+}
+
+#ifdef CONFIG_MULTIHART
+// harts run in a round-robin way, each for a quantum of instructions
+bool isa_hart_schedule() {
+  extern uint64_t g_nr_guest_instr;
+  void clint_sync();
+  clint_sync();
+  static uint64_t next_switch = CONFIG_HART_QUANTUM;
+  if (g_nr_guest_instr < next_switch) return false;
+  next_switch = g_nr_guest_instr + CONFIG_HART_QUANTUM;
+  return hart_switch((cur_hart + 1) % nr_hart);
+}
+#endif // CONFIG_MULTIHART
+
+#endif // CONFIG_HART_CONTEXT
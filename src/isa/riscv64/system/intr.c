@@ -62,6 +62,7 @@ static word_t get_trap_pc(word_t xtvec, word_t xcause) {
 }
 
 word_t raise_intr(word_t NO, vaddr_t epc) {
+  difftest_mark_trap();
 #ifdef CONFIG_DIFFTEST_REF_SPIKE
   switch (NO) {
 #ifdef CONFIG_RVH
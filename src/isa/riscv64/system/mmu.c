@@ -92,7 +92,7 @@ static inline bool check_permission(PTE *pte, bool ok, vaddr_t vaddr, int type)
     if (!(ok && pte->x && !pte->pad) || update_ad) {
       assert(!cpu.amo);
       INTR_TVAL_REG(EX_IPF) = vaddr;
-      longjmp_exception(EX_IPF);
+      raise_exception(EX_IPF);
       return false;
     }
   } else if (type == MEM_TYPE_READ) {
@@ -119,7 +119,7 @@ static inline bool check_permission(PTE *pte, bool ok, vaddr_t vaddr, int type)
       INTR_TVAL_REG(ex) = vaddr;
       cpu.amo = false;
       Logtr("Memory read translation exception!");
-      longjmp_exception(ex);
+      raise_exception(ex);
       return false;
     }
   } else {
@@ -133,7 +133,7 @@ static inline bool check_permission(PTE *pte, bool ok, vaddr_t vaddr, int type)
     if (!(ok && pte->w && !pte->pad) || update_ad) {
       INTR_TVAL_REG(EX_SPF) = vaddr;
       cpu.amo = false;
-      longjmp_exception(EX_SPF);
+      raise_exception(EX_SPF);
       return false;
     }
   }
@@ -334,17 +334,17 @@ static paddr_t ptw(vaddr_t vaddr, int type) {
         }else{
           mtval->val = vaddr;
         }
-        longjmp_exception(EX_IPF);
+        raise_exception(EX_IPF);
       }else{
         INTR_TVAL_REG(EX_IPF) = vaddr;
-        longjmp_exception(EX_IPF);
+        raise_exception(EX_IPF);
       }
 #else
       stval->val = vaddr;
       INTR_TVAL_REG(EX_IPF) = vaddr;
-      longjmp_exception(EX_IPF);
+      raise_exception(EX_IPF);
 #endif
-      break;
+      return MEM_RET_FAIL;
     case MEM_TYPE_READ:
 #ifdef CONFIG_RVH
       if(cpu.v){
@@ -358,13 +358,13 @@ static paddr_t ptw(vaddr_t vaddr, int type) {
         ex = cpu.amo ? EX_SPF : EX_LPF;
         INTR_TVAL_REG(ex) = vaddr;
       }
-      longjmp_exception(ex);
+      raise_exception(ex);
 #else
       ex = cpu.amo ? EX_SPF : EX_LPF;
       INTR_TVAL_REG(ex) = vaddr;
-      longjmp_exception(ex);
+      raise_exception(ex);
 #endif
-      break;
+      return MEM_RET_FAIL;
     case MEM_TYPE_WRITE:
 #ifdef CONFIG_RVH
       if(cpu.v){
@@ -373,16 +373,16 @@ static paddr_t ptw(vaddr_t vaddr, int type) {
         }else{
           mtval->val = vaddr;
         }
-        longjmp_exception(EX_SPF);
+        raise_exception(EX_SPF);
       }else{
         INTR_TVAL_REG(EX_SPF) = vaddr;
-        longjmp_exception(EX_SPF);
+        raise_exception(EX_SPF);
       }
 #else
       INTR_TVAL_REG(EX_SPF) = vaddr;
-      longjmp_exception(EX_SPF);
+      raise_exception(EX_SPF);
 #endif
-      break;
+      return MEM_RET_FAIL;
     default:
       break;
     }
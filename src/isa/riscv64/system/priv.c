@@ -27,12 +27,20 @@ int update_mmu_state();
 uint64_t clint_uptime();
 void fp_set_dirty();
 void fp_update_rm_cache(uint32_t rm);
+void fp_host_sync();
 void vp_set_dirty();
 
-rtlreg_t csr_array[4096] = {};
+GUEST_THREAD_LOCAL rtlreg_t csr_array[4096] = {};
 
+#ifdef CONFIG_USER_THREADS
+// the address of a thread-local csr_array is not a constant,
+// so the pointers are set up by init_csr() on every thread
+#define CSRS_DEF(name, addr) __thread concat(name, _t)* name;
+#define CSRS_INIT(name, addr) name = (concat(name, _t) *)&csr_array[addr];
+#else
 #define CSRS_DEF(name, addr) \
   concat(name, _t)* const name = (concat(name, _t) *)&csr_array[addr];
+#endif // CONFIG_USER_THREADS
 
 MAP(CSRS, CSRS_DEF)
 #ifdef CONFIG_RVV
@@ -45,9 +53,34 @@ MAP(CSRS, CSRS_DEF)
   MAP(HCSRS, CSRS_DEF)
 #endif //CONFIG_RVH
 
+#define CSRS_ADDR(name, addr) addr,
+const uint16_t csr_impl_addrs[] = {
+  MAP(CSRS, CSRS_ADDR)
+  MAP(CSRS_HPM, CSRS_ADDR)
+#ifdef CONFIG_RVV
+  MAP(VCSRS, CSRS_ADDR)
+#endif // CONFIG_RVV
+#ifdef CONFIG_RV_ARCH_CSRS
+  MAP(ARCH_CSRS, CSRS_ADDR)
+#endif // CONFIG_RV_ARCH_CSRS
+#ifdef CONFIG_RVH
+  MAP(HCSRS, CSRS_ADDR)
+#endif // CONFIG_RVH
+};
+const int nr_csr_impl = ARRLEN(csr_impl_addrs);
+
 #define CSRS_EXIST(name, addr) csr_exist[addr] = 1;
 static bool csr_exist[4096] = {};
 void init_csr() {
+#ifdef CONFIG_USER_THREADS
+  MAP(CSRS, CSRS_INIT)
+  #ifdef CONFIG_RVV
+  MAP(VCSRS, CSRS_INIT)
+  #endif // CONFIG_RVV
+  #ifdef CONFIG_RV_ARCH_CSRS
+  MAP(ARCH_CSRS, CSRS_INIT)
+  #endif // CONFIG_RV_ARCH_CSRS
+#endif // CONFIG_USER_THREADS
   MAP(CSRS, CSRS_EXIST)
   MAP(CSRS_HPM, CSRS_EXIST)
   #ifdef CONFIG_RVV
@@ -330,6 +363,7 @@ if (is_read(vsie))           { return (mie->val & (hideleg->val & (mideleg->val
 #ifdef CONFIG_RVV
 void vcsr_write(uint32_t addr,  rtlreg_t *src) {
   word_t *dest = csr_decode(addr);
+  difftest_mark_csr(dest);
   *dest = *src;
 }
 void vcsr_read(uint32_t addr,  rtlreg_t *dest) {
@@ -343,10 +377,37 @@ void disable_time_intr() {
     mie->val = mask_bitset(mie->val, MTIE_MASK, 0);
 }
 
+#ifdef CONFIG_SHARE
+static inline void difftest_mark_csr_write(word_t *dest) {
+  difftest_mark_csr(dest);
+  // the CSRs also written by the cases in csr_write()
+  difftest_mark_csr(mstatus);
+  difftest_mark_csr(mie);
+  difftest_mark_csr(mip);
+  difftest_mark_csr(fflags);
+  difftest_mark_csr(frm);
+  difftest_mark_csr(fcsr);
+#ifdef CONFIG_RVV
+  difftest_mark_csr(vxrm);
+  difftest_mark_csr(vxsat);
+#endif // CONFIG_RVV
+#ifdef CONFIG_RVH
+  difftest_mark_csr(vsstatus);
+  difftest_mark_csr(vstvec);
+  difftest_mark_csr(vsscratch);
+  difftest_mark_csr(vsepc);
+  difftest_mark_csr(vscause);
+  difftest_mark_csr(vstval);
+  difftest_mark_csr(vsatp);
+#endif // CONFIG_RVH
+}
+#endif // CONFIG_SHARE
+
 static inline void csr_write(word_t *dest, word_t src) {
   if((dest == &csr_perf)){
     return;
   }
+  IFDEF(CONFIG_SHARE, difftest_mark_csr_write(dest));
   #ifdef CONFIG_RVH
   if(cpu.v == 1 && (is_write(sstatus) || is_write(sie) || is_write(stvec) || is_write(sscratch)
         || is_write(sepc) || is_write(scause) || is_write(stval) || is_write(sip)
@@ -658,6 +719,13 @@ static void csrrw(rtlreg_t *dest, const rtlreg_t *src, uint32_t csrid) {
   word_t *csr = csr_decode(csrid);
   // Log("Decoding csr id %u to %p", csrid, csr);
   word_t tmp = (src != NULL ? *src : 0);
+#ifdef CONFIG_FPU_SOFT_HOST
+  // collect the exception flags left in host FPU before fflags or fs is accessed
+  if (csr == (void *)fflags || csr == (void *)fcsr ||
+      csr == (void *)mstatus || csr == (void *)sstatus) {
+    fp_host_sync();
+  }
+#endif
   if (dest != NULL) { *dest = csr_read(csr); }
   if (src != NULL) { csr_write(csr, tmp); }
 }
@@ -666,6 +734,7 @@ static word_t priv_instr(uint32_t op, const rtlreg_t *src) {
   switch (op) {
 #ifndef CONFIG_MODE_USER
     case 0x102: // sret
+      difftest_mark_trap();
 #ifdef CONFIG_RVH
       if (cpu.v == 0){
         cpu.v = hstatus->spv;
@@ -705,6 +774,7 @@ static word_t priv_instr(uint32_t op, const rtlreg_t *src) {
       update_mmu_state();
       return sepc->val;
     case 0x302: // mret
+      difftest_mark_trap();
       if (cpu.mode < MODE_M) {
         longjmp_exception(EX_II);
       }
@@ -835,6 +905,8 @@ void isa_hostcall(uint32_t id, rtlreg_t *dest, const rtlreg_t *src1,
 #ifdef CONFIG_MODE_USER
     case HOSTCALL_TRAP:
       Assert(imm == 0x8, "Unsupported exception = %ld", imm);
+      // a thread created by clone() starts from the next instruction
+      cpu.pc = *src1 + 4;
       uintptr_t host_syscall(uintptr_t id, uintptr_t arg1, uintptr_t arg2,
           uintptr_t arg3, uintptr_t arg4, uintptr_t arg5, uintptr_t arg6);
       cpu.gpr[10]._64 = host_syscall(cpu.gpr[17]._64, cpu.gpr[10]._64, cpu.gpr[11]._64,
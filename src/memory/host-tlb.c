@@ -19,6 +19,7 @@
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
 #include <cpu/cpu.h>
+#include <stdlib.h>
 
 #define HOSTTLB_SIZE_SHIFT 12
 #define HOSTTLB_SIZE (1 << HOSTTLB_SIZE_SHIFT)
@@ -28,10 +29,21 @@ typedef struct {
   vaddr_t gvpn; // guest virtual page number
 } HostTLBEntry;
 
+#ifdef CONFIG_HART_CONTEXT
+// every hart has its own host TLB, hosttlb points to the one of the selected hart
+static HostTLBEntry hosttlb0[HOSTTLB_SIZE * 3];
+static HostTLBEntry *hosttlb = hosttlb0;
+static HostTLBEntry **hart_hosttlb = NULL;
+static int nr_hart_hosttlb = 0;
+#define hostrtlb (&hosttlb[0])
+#define hostwtlb (&hosttlb[HOSTTLB_SIZE])
+#define hostxtlb (&hosttlb[HOSTTLB_SIZE * 2])
+#else
 static HostTLBEntry hosttlb[HOSTTLB_SIZE * 3];
 static HostTLBEntry* const hostrtlb = &hosttlb[0];
 static HostTLBEntry* const hostwtlb = &hosttlb[HOSTTLB_SIZE];
 static HostTLBEntry* const hostxtlb = &hosttlb[HOSTTLB_SIZE * 2];
+#endif // CONFIG_HART_CONTEXT
 
 static inline vaddr_t hosttlb_vpn(vaddr_t vaddr) {
   return (vaddr >> PAGE_SHIFT);
@@ -43,7 +55,7 @@ static inline int hosttlb_idx(vaddr_t vaddr) {
 
 void hosttlb_flush(vaddr_t vaddr) {
   if (vaddr == 0) {
-    memset(hosttlb, -1, sizeof(hosttlb));
+    memset(hosttlb, -1, sizeof(HostTLBEntry) * HOSTTLB_SIZE * 3);
   } else {
     vaddr_t gvpn = hosttlb_vpn(vaddr);
     int idx = hosttlb_idx(vaddr);
@@ -57,19 +69,48 @@ void hosttlb_init() {
   hosttlb_flush(0);
 }
 
-static paddr_t va2pa(struct Decode *s, vaddr_t vaddr, int len, int type) {
-  if (type != MEM_TYPE_IFETCH) save_globals(s);
+#ifdef CONFIG_HART_CONTEXT
+void hosttlb_select(int hart) {
+  if (hart >= nr_hart_hosttlb) {
+    hart_hosttlb = realloc(hart_hosttlb, sizeof(hart_hosttlb[0]) * (hart + 1));
+    assert(hart_hosttlb);
+    for (int i = nr_hart_hosttlb; i <= hart; i ++) {
+      hart_hosttlb[i] = (i == 0 ? hosttlb0 : malloc(sizeof(hosttlb0)));
+      assert(hart_hosttlb[i]);
+      memset(hart_hosttlb[i], -1, sizeof(hosttlb0));
+    }
+    nr_hart_hosttlb = hart + 1;
+  }
+  hosttlb = hart_hosttlb[hart];
+}
+#endif // CONFIG_HART_CONTEXT
+
+// Return false if the translation raises an exception returned to
+// ex_return_s, see raise_exception().
+static bool va2pa(struct Decode *s, vaddr_t vaddr, int len, int type, paddr_t *paddr) {
+  bool ex_return = false;
+  if (type != MEM_TYPE_IFETCH) {
+    save_globals(s);
+    ex_return = (s != NULL && s == ex_return_s);
+  }
   // int ret = isa_mmu_check(vaddr, len, type);
   // if (ret == MMU_DIRECT) return vaddr;
+  ex_return_armed = ex_return;
   paddr_t pg_base = isa_mmu_translate(vaddr, len, type);
+  ex_return_armed = false;
   int ret = pg_base & PAGE_MASK;
-  assert(ret == MEM_RET_OK);
-  return pg_base | (vaddr & PAGE_MASK);
+  if (unlikely(ret != MEM_RET_OK)) {
+    assert(ex_return && ex_return_s == NULL);
+    return false;
+  }
+  *paddr = pg_base | (vaddr & PAGE_MASK);
+  return true;
 }
 
 __attribute__((noinline))
 static word_t hosttlb_read_slowpath(struct Decode *s, vaddr_t vaddr, int len, int type) {
-  paddr_t paddr = va2pa(s, vaddr, len, type);
+  paddr_t paddr;
+  if (unlikely(!va2pa(s, vaddr, len, type, &paddr))) return 0;
   word_t data = paddr_read(paddr, len, type, cpu.mode, vaddr);
   if (likely(in_pmem(paddr))) {
     HostTLBEntry *e = type == MEM_TYPE_IFETCH ?
@@ -83,7 +124,8 @@ static word_t hosttlb_read_slowpath(struct Decode *s, vaddr_t vaddr, int len, in
 
 __attribute__((noinline))
 static void hosttlb_write_slowpath(struct Decode *s, vaddr_t vaddr, int len, word_t data) {
-  paddr_t paddr = va2pa(s, vaddr, len, MEM_TYPE_WRITE);
+  paddr_t paddr;
+  if (unlikely(!va2pa(s, vaddr, len, MEM_TYPE_WRITE, &paddr))) return;
   paddr_write(paddr, len, data, cpu.mode, vaddr);
   if (likely(in_pmem(paddr))) {
     HostTLBEntry *e = &hostwtlb[hosttlb_idx(vaddr)];
@@ -97,7 +139,8 @@ word_t hosttlb_read(struct Decode *s, vaddr_t vaddr, int len, int type) {
 #ifdef CONFIG_RVH
   extern bool has_two_stage_translation();
   if(has_two_stage_translation()){
-    paddr_t paddr = va2pa(s, vaddr, len, type);
+    paddr_t paddr;
+    if (unlikely(!va2pa(s, vaddr, len, type, &paddr))) return 0;
     return paddr_read(paddr, len, type, cpu.mode, vaddr);
   }
 #endif
@@ -113,11 +156,26 @@ word_t hosttlb_read(struct Decode *s, vaddr_t vaddr, int len, int type) {
   }
 }
 
+// host address of vaddr if it hits the read entries, NULL otherwise
+uint8_t *hosttlb_lookup_read(vaddr_t vaddr) {
+  HostTLBEntry *e = &hostrtlb[hosttlb_idx(vaddr)];
+  if (unlikely(e->gvpn != hosttlb_vpn(vaddr))) return NULL;
+  return e->offset + vaddr;
+}
+
+// host address of vaddr if it hits the write entries, NULL otherwise
+uint8_t *hosttlb_lookup_write(vaddr_t vaddr) {
+  HostTLBEntry *e = &hostwtlb[hosttlb_idx(vaddr)];
+  if (unlikely(e->gvpn != hosttlb_vpn(vaddr))) return NULL;
+  return e->offset + vaddr;
+}
+
 void hosttlb_write(struct Decode *s, vaddr_t vaddr, int len, word_t data) {
   #ifdef CONFIG_RVH
   extern bool has_two_stage_translation();
   if(has_two_stage_translation()){
-    paddr_t paddr = va2pa(s, vaddr, len, MEM_TYPE_WRITE);
+    paddr_t paddr;
+    if (unlikely(!va2pa(s, vaddr, len, MEM_TYPE_WRITE, &paddr))) return;
     return paddr_write(paddr, len, data, cpu.mode, vaddr);
   }
 #endif
@@ -127,5 +185,7 @@ void hosttlb_write(struct Decode *s, vaddr_t vaddr, int len, word_t data) {
     hosttlb_write_slowpath(s, vaddr, len, data);
     return;
   }
+  IFDEF(CONFIG_REF_SNAPSHOT, pmem_snapshot_hook(host_to_guest(e->offset + vaddr), len));
+  IFDEF(CONFIG_HART_CONTEXT, pmem_reservation_hook(host_to_guest(e->offset + vaddr), len));
   host_write(e->offset + vaddr, len, data);
 }
@@ -20,6 +20,9 @@
 #include <device/mmio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include <cpu/cpu.h>
 #include "../local-include/csr.h"
 #include "../local-include/intr.h"
@@ -68,12 +71,18 @@ static inline word_t pmem_read(paddr_t addr, int len) {
 }
 
 static inline void pmem_write(paddr_t addr, int len, word_t data) {
+  pmem_snapshot_hook(addr, len);
+  pmem_reservation_hook(addr, len);
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
   store_commit_queue_push(addr, data, len);
 #endif
   host_write(guest_to_host(addr), len, data);
 }
 
+#ifdef CONFIG_DIFFTEST_STORE_COMMIT
+static void store_commit_queue_reset();
+#endif
+
 static inline void raise_access_fault(int cause, vaddr_t vaddr) {
   INTR_TVAL_REG(cause) = vaddr;
   // cpu.amo flag must be reset to false before longjmp_exception,
@@ -107,9 +116,7 @@ void init_mem() {
 #endif
 
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
-  for (int i = 0; i < STORE_QUEUE_SIZE; i++) {
-    store_commit_queue[i].valid = 0;
-  }
+  store_commit_queue_reset();
 #endif
 
 #ifdef CONFIG_MEM_RANDOM
@@ -246,8 +253,25 @@ void paddr_write(paddr_t addr, int len, word_t data, int mode, vaddr_t vaddr) {
 
 
 #ifdef CONFIG_DIFFTEST_STORE_COMMIT
-store_commit_t store_commit_queue[STORE_QUEUE_SIZE];
+// Single-producer single-consumer ring: NEMU pushes committed stores and the DUT
+// pops them, possibly from another thread. head and tail are free-running counters,
+// each written by only one side, so no lock is needed. A DUT in the same thread
+// drains the queue between calls, so a half full queue ends the running batch.
+static_assert((STORE_QUEUE_SIZE & (STORE_QUEUE_SIZE - 1)) == 0, "STORE_QUEUE_SIZE must be a power of 2");
+static store_commit_t store_commit_queue[STORE_QUEUE_SIZE];
 static uint64_t head = 0, tail = 0;
+static uint64_t dropped = 0;
+static pid_t consumer_tid = 0;
+static __thread pid_t self_tid = 0;
+
+static void store_commit_queue_reset() {
+  head = tail = dropped = 0;
+}
+
+static inline pid_t store_commit_gettid() {
+  if (unlikely(self_tid == 0)) self_tid = syscall(SYS_gettid);
+  return self_tid;
+}
 
 void store_commit_queue_push(uint64_t addr, uint64_t data, int len) {
 #ifndef CONFIG_DIFFTEST_STORE_COMMIT_AMO
@@ -255,15 +279,34 @@ void store_commit_queue_push(uint64_t addr, uint64_t data, int len) {
     return;
   }
 #endif // CONFIG_DIFFTEST_STORE_COMMIT_AMO
-  static int overflow = 0;
-  store_commit_t *commit = store_commit_queue + tail;
-  if (commit->valid && !overflow) { // store commit queue overflow
-    overflow = 1;
-    printf("[WARNING] difftest store queue overflow\n");
-  };
+  uint64_t t = tail;
+  uint64_t used = t - __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  if (unlikely(used >= STORE_QUEUE_SIZE / 2)) {
+    pid_t consumer = __atomic_load_n(&consumer_tid, __ATOMIC_RELAXED);
+    if (consumer != 0 && consumer != store_commit_gettid()) {
+      // the DUT consumes the queue from another thread, wait for it if the queue is full
+      while (t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == STORE_QUEUE_SIZE) {
+        sched_yield();
+      }
+    } else {
+      // The DUT consumes the queue between calls, so end the batch after this
+      // instruction to let it drain. The other half of the queue holds the
+      // rest of the stores of this instruction.
+      if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+      if (used == STORE_QUEUE_SIZE) {
+        // the DUT did not drain the queue, keep the older stores and report the loss
+        if (dropped == 0) {
+          printf("[WARNING] difftest store queue overflow\n");
+        }
+        __atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELEASE);
+        return;
+      }
+    }
+  }
+
+  store_commit_t *commit = store_commit_queue + (t & (STORE_QUEUE_SIZE - 1));
   uint64_t offset = addr % 8ULL;
   commit->addr = addr - offset;
-  commit->valid = 1;
   switch (len) {
     case 1:
       commit->data = (data & 0xffULL) << (offset << 3);
@@ -284,36 +327,73 @@ void store_commit_queue_push(uint64_t addr, uint64_t data, int len) {
     default:
       assert(0);
   }
-  tail = (tail + 1) % STORE_QUEUE_SIZE;
+  __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
 }
 
-store_commit_t *store_commit_queue_pop() {
-  store_commit_t *result = store_commit_queue + head;
-  if (!result->valid) {
-    return NULL;
+// pop at most n entries into commit, return the number of entries popped
+int store_commit_queue_pop(store_commit_t *commit, int n) {
+  if (unlikely(consumer_tid == 0)) {
+    __atomic_store_n(&consumer_tid, store_commit_gettid(), __ATOMIC_RELAXED);
+  }
+  uint64_t h = head;
+  uint64_t nr_valid = __atomic_load_n(&tail, __ATOMIC_ACQUIRE) - h;
+  int nr = nr_valid < (uint64_t)n ? nr_valid : n;
+  for (int i = 0; i < nr; i ++) {
+    commit[i] = store_commit_queue[(h + i) & (STORE_QUEUE_SIZE - 1)];
+  }
+  __atomic_store_n(&head, h + nr, __ATOMIC_RELEASE);
+  return nr;
+}
+
+// report and clear the number of dropped stores
+static inline void report_dropped() {
+  uint64_t nr = __atomic_exchange_n(&dropped, 0, __ATOMIC_ACQ_REL);
+  if (nr != 0) {
+    printf("NEMU dropped %lu store commits since the queue is full.\n", nr);
   }
-  result->valid = 0;
-  head = (head + 1) % STORE_QUEUE_SIZE;
-  return result;
 }
 
 int check_store_commit(uint64_t *addr, uint64_t *data, uint8_t *mask) {
   *addr = *addr - (*addr % 0x8ULL);
-  store_commit_t *commit = store_commit_queue_pop();
+  store_commit_t commit;
   int result = 0;
-  if (!commit) {
+  if (store_commit_queue_pop(&commit, 1) == 0) {
     printf("NEMU does not commit any store instruction.\n");
+    report_dropped();
     result = 1;
   }
-  else if (*addr != commit->addr || *data != commit->data || *mask != commit->mask) {
-    *addr = commit->addr;
-    *data = commit->data;
-    *mask = commit->mask;
+  else if (*addr != commit.addr || *data != commit.data || *mask != commit.mask) {
+    *addr = commit.addr;
+    *data = commit.data;
+    *mask = commit.mask;
     result = 1;
   }
   return result;
 }
 
+// pop at most n committed stores, return the number of stores popped,
+// or -1 if the queue is empty and stores have been dropped
+int store_commit_batch(uint64_t *addr, uint64_t *data, uint8_t *mask, int n) {
+  store_commit_t commit[64];
+  int total = 0;
+  while (total < n) {
+    int batch = n - total < 64 ? n - total : 64;
+    int nr = store_commit_queue_pop(commit, batch);
+    for (int i = 0; i < nr; i ++) {
+      addr[total + i] = commit[i].addr;
+      data[total + i] = commit[i].data;
+      mask[total + i] = commit[i].mask;
+    }
+    total += nr;
+    if (nr < batch) break;
+  }
+  if (total == 0 && __atomic_load_n(&dropped, __ATOMIC_ACQUIRE) != 0) {
+    report_dropped();
+    return -1;
+  }
+  return total;
+}
+
 #endif
 
 char *mem_dump_file = NULL;
@@ -0,0 +1,181 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Restore and run a batch of checkpoints listed in a manifest.
+// NEMU is initialized once, then every checkpoint runs in a forked worker,
+// which starts from a copy-on-write view of the freshly initialized emulator,
+// so there is no need to reset cpu/csr/device states or remap pmem by hand.
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/image_loader.h>
+#include <memory/paddr.h>
+#include <checkpoint/cpt_env.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+char *cpt_batch_manifest = NULL;
+int cpt_batch_jobs = 1;
+
+#if !defined(CONFIG_SHARE) && !defined(CONFIG_MODE_USER)
+
+void init_alarm();
+
+typedef struct {
+  char *cpt;
+  uint64_t max_instr;
+  // written by the worker into shared memory
+  bool done;
+  int state;
+  int halt_ret;
+  uint64_t pc;
+  uint64_t instr;
+  uint64_t time_us;
+} BatchJob;
+
+static BatchJob *load_manifest(const char *manifest, uint64_t default_max_instr, int *nr_job) {
+  FILE *fp = fopen(manifest, "r");
+  Assert(fp, "Can not open manifest '%s'", manifest);
+
+  int nr = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    nr ++;
+  }
+
+  // results are written by the workers, so jobs live in shared memory
+  BatchJob *jobs = mmap(NULL, sizeof(BatchJob) * (nr + 1), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  Assert(jobs != MAP_FAILED, "Can not allocate batch jobs");
+
+  rewind(fp);
+  int n = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    // each line is "CPT [MAX_INSTR]", empty lines and lines starting with '#' are skipped
+    char *cpt = strtok(line, " \t\n");
+    if (cpt == NULL || cpt[0] == '#') continue;
+    char *limit = strtok(NULL, " \t\n");
+    jobs[n].cpt = strdup(cpt);
+    jobs[n].max_instr = limit ? strtoull(limit, NULL, 0) : default_max_instr;
+    n ++;
+  }
+  fclose(fp);
+
+  *nr_job = n;
+  return jobs;
+}
+
+static void run_job(BatchJob *job, int id) {
+  // each worker has its own log, the report is written by the parent
+  char log[4096];
+  snprintf(log, sizeof(log), "%s.%d.log", cpt_batch_manifest, id);
+  Assert(freopen(log, "w", stdout), "Can not open '%s'", log);
+  dup2(fileno(stdout), fileno(stderr));
+
+  // interval timers are not inherited by fork()
+  init_alarm();
+
+  load_img(job->cpt, "Gcpt file from batch manifest", RESET_VECTOR, 0);
+  if (restorer != NULL) {
+    load_img(restorer, "Gcpt restorer form cmdline", RESET_VECTOR, 0xf00);
+  }
+
+  uint64_t start = get_time();
+  cpu_exec(job->max_instr);
+
+  extern uint64_t g_nr_guest_instr;
+  job->time_us = get_time() - start;
+  job->instr = g_nr_guest_instr;
+  job->state = nemu_state.state;
+  job->halt_ret = nemu_state.halt_ret;
+  job->pc = cpu.pc;
+  job->done = true;
+
+  extern void log_close();
+  log_close();
+  fflush(stdout);
+  _exit(0);
+}
+
+static bool job_good(BatchJob *job) {
+  return job->done && (job->state == NEMU_QUIT || (job->state == NEMU_END && job->halt_ret == 0));
+}
+
+static void write_report(FILE *fp, BatchJob *jobs, int nr_job) {
+  fprintf(fp, "# id state ret pc instr time_us mips cpt\n");
+  for (int i = 0; i < nr_job; i ++) {
+    BatchJob *job = &jobs[i];
+    if (!job->done) {
+      fprintf(fp, "%d crash - - - - - %s\n", i, job->cpt);
+      continue;
+    }
+    const char *state = (job->state == NEMU_QUIT ? "quit" :
+        (job->state == NEMU_END ? (job->halt_ret == 0 ? "good" : "bad") : "abort"));
+    double mips = job->time_us ? (double)job->instr / job->time_us : 0;
+    fprintf(fp, "%d %s %d 0x%lx %lu %lu %.2f %s\n", i, state, job->halt_ret,
+        job->pc, job->instr, job->time_us, mips, job->cpt);
+  }
+}
+
+void cpt_batch_run(uint64_t default_max_instr) {
+  int nr_job;
+  BatchJob *jobs = load_manifest(cpt_batch_manifest, default_max_instr, &nr_job);
+  Log("Running %d checkpoints from %s with %d workers", nr_job, cpt_batch_manifest, cpt_batch_jobs);
+
+  fflush(stdout);
+  uint64_t start = get_time();
+  int next = 0, running = 0;
+  while (next < nr_job || running > 0) {
+    if (next < nr_job && running < cpt_batch_jobs) {
+      pid_t pid = fork();
+      Assert(pid >= 0, "Can not fork worker");
+      if (pid == 0) {
+        run_job(&jobs[next], next);
+      }
+      next ++;
+      running ++;
+      continue;
+    }
+
+    int status;
+    pid_t pid = wait(&status);
+    Assert(pid > 0, "Can not wait worker");
+    running --;
+  }
+  uint64_t time_us = get_time() - start;
+
+  char report[4096];
+  snprintf(report, sizeof(report), "%s.report", cpt_batch_manifest);
+  FILE *fp = fopen(report, "w");
+  Assert(fp, "Can not open '%s'", report);
+  write_report(fp, jobs, nr_job);
+  fclose(fp);
+
+  int nr_good = 0;
+  uint64_t instr = 0;
+  for (int i = 0; i < nr_job; i ++) {
+    nr_good += job_good(&jobs[i]);
+    instr += jobs[i].done ? jobs[i].instr : 0;
+  }
+  Log("%d/%d checkpoints finished with good state, report is written to %s.report",
+      nr_good, nr_job, cpt_batch_manifest);
+  Log("total guest instructions = %'ld, host time spent = %'ld us", instr, time_us);
+
+  nemu_state.state = (nr_good == nr_job ? NEMU_QUIT : NEMU_ABORT);
+}
+
+#endif
@@ -40,6 +40,8 @@ static int difftest_port = 1234;
 char *max_instr = NULL;
 extern char *reg_dump_file;
 extern char *mem_dump_file;
+extern char *cpt_batch_manifest;
+extern int cpt_batch_jobs;
 
 int is_batch_mode() { return batch_mode; }
 
@@ -77,13 +79,19 @@ static inline int parse_args(int argc, char *argv[]) {
     {"uniform-cpt"        , no_argument      , NULL, 'u'},
     {"cpt-interval"       , required_argument, NULL, 5},
     {"cpt-mmode"          , no_argument      , NULL, 7},
+    {"cpt-waypoint"       , required_argument, NULL, 9},
 
     // profiling
     {"simpoint-profile"   , no_argument      , NULL, 3},
+    {"simpoint-bbv-binary", no_argument      , NULL, 10},
+    {"simpoint-max-k"     , required_argument, NULL, 11},
+    {"simpoint-intervals" , required_argument, NULL, 12},
     {"dont-skip-boot"     , no_argument      , NULL, 6},
 
     // restore cpt
     {"cpt-id"             , required_argument, NULL, 4},
+    {"cpt-batch"          , required_argument, NULL, 13},
+    {"cpt-batch-jobs"     , required_argument, NULL, 14},
 
     // dump state
     {"dump-mem"           , required_argument, NULL, 'M'},
@@ -132,9 +140,11 @@ static inline int parse_args(int argc, char *argv[]) {
       case 'R':
           reg_dump_file = optarg;
           break;
+#ifndef CONFIG_MODE_USER
       case 'M':
           mem_dump_file = optarg;
           break;
+#endif
 
       case 5: sscanf(optarg, "%lu", &checkpoint_interval); break;
 
@@ -144,6 +154,10 @@ static inline int parse_args(int argc, char *argv[]) {
         Log("Doing Simpoint Profiling");
         break;
 
+      case 10: simpoint_bbv_binary = true; break;
+      case 11: sscanf(optarg, "%d", &simpoint_max_k); break;
+      case 12: simpoint_intervals = optarg; break;
+
       case 6:
         // start profiling/checkpointing right after boot,
         // instead of waiting for the pseudo inst to notify NEMU.
@@ -157,6 +171,20 @@ static inline int parse_args(int argc, char *argv[]) {
 
       case 4: sscanf(optarg, "%d", &cpt_id); break;
 
+      case 13:
+        cpt_batch_manifest = optarg;
+        Log("Restoring checkpoints listed in %s", optarg);
+        break;
+      case 14: sscanf(optarg, "%d", &cpt_batch_jobs); break;
+
+      case 9:
+        if (sscanf(optarg, "%lu:%lu", &cpt_waypoint_begin, &cpt_waypoint_end) != 2 ||
+            cpt_waypoint_end <= cpt_waypoint_begin) {
+          panic("Bad waypoint window %s, should be BEGIN:END", optarg);
+        }
+        Log("Taking simpoint checkpoints in [%lu, %lu)", cpt_waypoint_begin, cpt_waypoint_end);
+        break;
+
       case 8:
         log_file = optarg;
         small_log = true;
@@ -182,10 +210,16 @@ static inline int parse_args(int argc, char *argv[]) {
         printf("\t-u,--uniform-cpt        uniformly take cpt with fixed interval\n");
         printf("\t--cpt-interval=INTERVAL cpt interval: the profiling period for simpoint; the checkpoint interval for uniform cpt\n");
         printf("\t--cpt-mmode             force to take cpt in mmode, which might not work.\n");
+        printf("\t--cpt-waypoint=B:E      only take simpoints in [B, E), restoring from the waypoint cpt taken at B\n");
 
         printf("\t--simpoint-profile      simpoint profiling\n");
+        printf("\t--simpoint-bbv-binary   write simpoint bbv in compact binary format\n");
+        printf("\t--simpoint-max-k=K      cluster bbv with at most K clusters and write simpoints0/weights0\n");
+        printf("\t--simpoint-intervals=I1,I2  also profile bbv with interval I1, I2, ... in the same run\n");
         printf("\t--dont-skip-boot        profiling/checkpoint immediately after boot\n");
         printf("\t--cpt-id                checkpoint id\n");
+        printf("\t--cpt-batch=MANIFEST    restore and run every checkpoint listed in MANIFEST, in batch mode\n");
+        printf("\t--cpt-batch-jobs=N      run the checkpoints of --cpt-batch with N workers\n");
         printf("\t-M,--dump-mem=DUMP_FILE dump memory into FILE\n");
         printf("\t-R,--dump-reg=DUMP_FILE dump register value into FILE\n");
         printf("\n");
@@ -237,7 +271,17 @@ void init_monitor(int argc, char *argv[]) {
   uint64_t bbl_start;
   long img_size; // how large we should copy for difftest
 
-  if (checkpoint_restoring) {
+  if (cpt_batch_manifest != NULL) {
+    // Checkpoints are loaded by batch workers after fork(), see batch.c
+    assert(batch_mode);
+    assert(!checkpoint_taking && profiling_state == NoProfiling);
+    assert(diff_so_file == NULL);
+    assert(cpt_batch_jobs > 0);
+
+    img_size = MEMORY_SIZE;
+    bbl_start = MEMORY_SIZE;
+
+  } else if (checkpoint_restoring) {
     // When restoring cpt, gcpt restorer from cmdline is optional,
     // because a gcpt already ships a restorer
     assert(img_file != NULL);
@@ -275,6 +275,14 @@ static int cmd_help(char *args) {
 void ui_mainloop() {
   if (is_batch_mode()) {
     extern char *max_instr;
+#ifdef CONFIG_MODE_SYSTEM
+    extern char *cpt_batch_manifest;
+    if (cpt_batch_manifest != NULL) {
+      void cpt_batch_run(uint64_t default_max_instr);
+      cpt_batch_run((max_instr == NULL) ? -1 : (uint64_t) atol(max_instr));
+      return;
+    }
+#endif
     cmd_c(max_instr);
     return;
   }
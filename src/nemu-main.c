@@ -17,6 +17,7 @@
 #ifndef CONFIG_SHARE
 void init_monitor(int, char *[]);
 void engine_start();
+void simpoint_finish();
 int is_exit_status_bad();
 
 int main(int argc, char *argv[]) {
@@ -26,6 +27,9 @@ int main(int argc, char *argv[]) {
   /* Start engine. */
   engine_start();
 
+  /* Flush the SimPoint profile and cluster it. */
+  simpoint_finish();
+
   return is_exit_status_bad();
 }
 #endif
@@ -17,11 +17,24 @@
 
 #ifdef CONFIG_ISA_riscv64
 void init_csr();
+void init_clint();
 
 void isa_init_user(word_t sp) {
   init_csr();
+  init_clint();
   cpu.mode = MODE_U;
   cpu.gpr[2]._64 = sp;
   //cpu.edx = 0; // no handler for atexit()
 }
+
+#ifdef CONFIG_USER_THREADS
+// a new thread starts with the state of its parent at clone()
+void isa_init_user_thread(const void *parent, word_t sp, bool set_tls, word_t tls) {
+  init_csr();
+  isa_snapshot_restore(parent);
+  cpu.gpr[10]._64 = 0; // clone() returns 0 in the new thread
+  if (sp != 0) cpu.gpr[2]._64 = sp;
+  if (set_tls) cpu.gpr[4]._64 = tls;
+}
+#endif
 #endif
@@ -17,6 +17,7 @@
 #include <isa.h>
 #include <memory/host.h>
 #include <stdlib.h>
+#include <sys/param.h>
 
 #define ROUNDUP(a, sz)      ((((uintptr_t)a) + (sz) - 1) & ~((sz) - 1))
 #define ROUNDDOWN(a, sz)    ((((uintptr_t)a)) & ~((sz) - 1))
@@ -37,7 +38,25 @@ word_t vaddr_read_safe(vaddr_t addr, int len) {
   return vaddr_read(NULL, addr, len, MMU_DYNAMIC);
 }
 
+// there is no pmem in user mode, guest addresses are host addresses
+unsigned long MEMORY_SIZE = 0;
 
+uint8_t* guest_to_host(paddr_t paddr) { return user_to_host(paddr); }
+paddr_t host_to_guest(uint8_t *haddr) { return host_to_user(haddr); }
+uint8_t *get_pmem() { return NULL; }
+
+word_t paddr_read(paddr_t addr, int len, int type, int mode, vaddr_t vaddr) {
+  return host_read(user_to_host(addr), len);
+}
+
+void paddr_write(paddr_t addr, int len, word_t data, int mode, vaddr_t vaddr) {
+  host_write(user_to_host(addr), len, data);
+}
+
+
+// The vmas are kept in a treap ordered by address. Every node also
+// summarizes its subtree, so that the first free area fitting a dynamic
+// mapping is found without scanning all the vmas.
 typedef struct vma_t {
   uintptr_t addr;
   size_t length;
@@ -45,62 +64,85 @@ typedef struct vma_t {
   int flags;
   int fd;
   off_t offset;
-  struct vma_t *next;
-  struct vma_t *prev;
+  // treap and subtree summary
+  uint32_t prio;
+  uintptr_t min_addr; // start of the first vma in the subtree
+  uintptr_t max_end;  // end of the last vma in the subtree
+  size_t max_gap;     // largest free area between two vmas in the subtree
+  struct vma_t *left;
+  struct vma_t *right;
 } vma_t;
 
-static vma_t vma_list = { };
-static vma_t *dyn_start;
+// dynamic mappings are allocated from [DYN_START, DYN_END), and the area
+// above DYN_END is reserved for the kernel
+#define DYN_START 0x80000000ul
+#define DYN_END   0xc0000000ul
+
+static vma_t *vma_root = NULL;
 
-#define vma_foreach(p) for (p = vma_list.next; !vma_list_is_end(p); p = p->next)
+#ifdef CONFIG_USER_THREADS
+#include <pthread.h>
+// the vmas are shared by all guest threads, user_mremap() may call the others
+static pthread_mutex_t vma_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+#define vma_lock()   pthread_mutex_lock(&vma_lock)
+#define vma_unlock() pthread_mutex_unlock(&vma_lock)
+#else
+#define vma_lock()
+#define vma_unlock()
+#endif
 
-static inline void vma_list_add_after(vma_t *left, vma_t *_new) {
-  vma_t *right = left->next;
-  _new->next = right;
-  _new->prev = left;
-  left->next = _new;
-  right->prev = _new;
+static inline uintptr_t vma_end(vma_t *p) {
+  return p->addr + p->length;
 }
 
-static inline bool vma_list_is_end(vma_t *p) {
-  return (p == &vma_list);
+static inline void vma_update(vma_t *p) {
+  vma_t *l = p->left, *r = p->right;
+  p->min_addr = (l ? l->min_addr : p->addr);
+  p->max_end = (r ? r->max_end : vma_end(p));
+  p->max_gap = 0;
+  if (l) p->max_gap = MAX(MAX(p->max_gap, l->max_gap), p->addr - l->max_end);
+  if (r) p->max_gap = MAX(MAX(p->max_gap, r->max_gap), r->min_addr - vma_end(p));
 }
 
-static inline vma_t* vma_list_find_fix_area(uintptr_t addr, size_t length) {
-  vma_t *p;
-  vma_foreach(p) {
-    if (p->addr == addr && p->length == length) return p;
+// split the treap into vmas starting below addr and the others
+static void vma_split(vma_t *t, uintptr_t addr, vma_t **l, vma_t **r) {
+  if (t == NULL) { *l = *r = NULL; return; }
+  if (t->addr < addr) {
+    vma_split(t->right, addr, &t->right, r);
+    *l = t;
+  } else {
+    vma_split(t->left, addr, l, &t->left);
+    *r = t;
   }
-  return NULL;
+  vma_update(t);
 }
 
-static inline vma_t* vma_list_new_fix_area(uintptr_t addr, size_t length) {
-  vma_t *candidate = NULL;
-  vma_t *p;
-  vma_foreach(p) {
-    uintptr_t l = p->addr;
-    uintptr_t r = p->addr + p->length;
-    if (!((addr + length <= l) || (addr >= r))) {
-      // overlap
-      return NULL;
-    }
-    vma_t *right = p->next;
-    if (p->addr < addr && addr < right->addr) { candidate = p; }
+// all vmas in l are below the ones in r
+static vma_t* vma_merge(vma_t *l, vma_t *r) {
+  if (l == NULL) return r;
+  if (r == NULL) return l;
+  if (l->prio > r->prio) {
+    l->right = vma_merge(l->right, r);
+    vma_update(l);
+    return l;
+  } else {
+    r->left = vma_merge(l, r->left);
+    vma_update(r);
+    return r;
   }
-  assert(candidate != NULL);
-  return candidate;
 }
 
-// return the vma_t whose right is suitable
-static inline vma_t* vma_list_new_dyn_area(size_t length) {
-  vma_t *p = dyn_start;
-  for (; !vma_list_is_end(p); p = p->next) {
-    vma_t *right = p->next;
-    size_t free = (uint8_t *)right->addr - ((uint8_t *)p->addr + p->length);
-    if (free >= length) return p;
+static vma_t* vma_insert(vma_t *t, vma_t *_new) {
+  if (t == NULL) return _new;
+  if (_new->prio > t->prio) {
+    vma_split(t, _new->addr, &_new->left, &_new->right);
+    vma_update(_new);
+    return _new;
   }
-  assert(0);
-  return NULL;
+  if (_new->addr < t->addr) t->left = vma_insert(t->left, _new);
+  else t->right = vma_insert(t->right, _new);
+  vma_update(t);
+  return t;
 }
 
 static inline vma_t* vma_new(uintptr_t addr, size_t length, int prot,
@@ -108,77 +150,201 @@ static inline vma_t* vma_new(uintptr_t addr, size_t length, int prot,
   vma_t *vma = (vma_t *) malloc(sizeof(vma_t));
   assert(vma);
   *vma = (vma_t) { .addr = addr, .length = length, .prot = prot,
-    .flags = flags, .fd = fd, .offset = offset };
+    .flags = flags, .fd = fd, .offset = offset, .prio = rand() };
+  vma_update(vma);
   return vma;
 }
 
-void init_mem() {
-  vma_t *p = &vma_list;
-  p->next = p->prev = p;
+static void vma_free(vma_t *t) {
+  if (t == NULL) return;
+  vma_free(t->left);
+  vma_free(t->right);
+  free(t);
+}
 
-  vma_t *zero = vma_new(0ul, 0ul, 0, 0, -1, 0);
-  vma_list_add_after(p, zero);
+// shorten the vma across addr to end at addr, and return the rest of it
+static vma_t* vma_cut_tail(vma_t *t, uintptr_t addr) {
+  if (t == NULL || addr <= t->min_addr || addr >= t->max_end) return NULL;
+  vma_t *tail = NULL;
+  if (addr < t->addr) tail = vma_cut_tail(t->left, addr);
+  else if (addr >= vma_end(t)) tail = vma_cut_tail(t->right, addr);
+  else if (addr > t->addr) {
+    tail = vma_new(addr, vma_end(t) - addr, t->prot, t->flags, t->fd,
+        t->fd == -1 ? 0 : t->offset + (addr - t->addr));
+    t->length = addr - t->addr;
+  }
+  vma_update(t);
+  return tail;
+}
 
-  dyn_start = vma_new(0x80000000ul, 0ul, 0, 0, -1, 0);
-  vma_list_add_after(zero, dyn_start);
+// split the vma across addr into two, so that addr becomes a boundary of vmas
+static vma_t* vma_cut(vma_t *t, uintptr_t addr) {
+  vma_t *tail = vma_cut_tail(t, addr);
+  // the tail may have a higher priority than the vmas above it
+  return (tail ? vma_insert(t, tail) : t);
+}
 
-  vma_t *kernel = vma_new(0xc0000000ul, 0x40000000ul, 0, 0, -1, 0);
-  vma_list_add_after(dyn_start, kernel);
+// take out the vmas in [addr, addr + length) from the treap, splitting the ones across the boundaries
+static vma_t* vma_extract(uintptr_t addr, size_t length) {
+  vma_t *l, *m, *r;
+  vma_root = vma_cut(vma_cut(vma_root, addr), addr + length);
+  vma_split(vma_root, addr, &l, &m);
+  vma_split(m, addr + length, &m, &r);
+  vma_root = vma_merge(l, r);
+  return m;
+}
+
+static vma_t* vma_find(uintptr_t addr) {
+  vma_t *p = vma_root;
+  while (p != NULL) {
+    if (addr < p->addr) p = p->left;
+    else if (addr >= vma_end(p)) p = p->right;
+    else return p;
+  }
+  return NULL;
+}
+
+bool user_access_ok(vaddr_t addr, int len, int prot) {
+  vma_lock();
+  vma_t *p = vma_find(addr);
+  bool ok = (p != NULL && addr + len <= vma_end(p) && (p->prot & prot) == prot);
+  vma_unlock();
+  return ok;
+}
+
+// start of the first vma at or above addr
+static uintptr_t vma_next_start(uintptr_t addr) {
+  uintptr_t next = UINTPTR_MAX;
+  vma_t *p = vma_root;
+  while (p != NULL) {
+    if (p->addr >= addr) { next = p->addr; p = p->left; }
+    else p = p->right;
+  }
+  return next;
+}
+
+// first fit of length bytes in [lo, hi) of the subtree,
+// *prev_end is the end of the vma before the subtree
+static uintptr_t vma_find_gap(vma_t *t, uintptr_t *prev_end, size_t length,
+    uintptr_t lo, uintptr_t hi) {
+  if (t == NULL || *prev_end >= hi) return 0;
+  size_t gap_before = (t->min_addr > *prev_end ? t->min_addr - *prev_end : 0);
+  if (t->max_end <= lo || MAX(t->max_gap, gap_before) < length) {
+    // no fit in the subtree, or it is below lo
+    *prev_end = MAX(*prev_end, t->max_end);
+    return 0;
+  }
+  uintptr_t ret = vma_find_gap(t->left, prev_end, length, lo, hi);
+  if (ret != 0) return ret;
+  uintptr_t start = MAX(*prev_end, lo);
+  if (start + length <= MIN(t->addr, hi)) return start;
+  *prev_end = MAX(*prev_end, vma_end(t));
+  return vma_find_gap(t->right, prev_end, length, lo, hi);
+}
+
+static uintptr_t vma_new_dyn_area(size_t length) {
+  uintptr_t prev_end = 0;
+  uintptr_t addr = vma_find_gap(vma_root, &prev_end, length, DYN_START, DYN_END);
+  if (addr == 0) {
+    // the area after the last vma
+    addr = MAX(prev_end, DYN_START);
+    assert(addr + length <= DYN_END);
+  }
+  return addr;
+}
+
+void init_mem() {
+  vma_t *kernel = vma_new(DYN_END, 0x40000000ul, 0, 0, -1, 0);
+  vma_root = vma_insert(vma_root, kernel);
 }
 
 void *user_mmap(void *addr, size_t length, int prot,
     int flags, int fd, off_t offset) {
-  vma_t *left = NULL;
   length = ROUNDUP(length, 4096);
+  vma_lock();
+  vma_t *old = NULL;
   if (flags & MAP_FIXED) {
-    left = vma_list_new_fix_area((uintptr_t)addr, length);
-    assert(left != NULL);
+    // the new mapping replaces the old ones in the area
+    old = vma_extract((uintptr_t)addr, length);
   } else {
-    left = vma_list_new_dyn_area(length);
-    addr = (uint8_t *)left->addr + left->length;
+    addr = (void *)vma_new_dyn_area(length);
     flags |= MAP_FIXED;
   }
-  vma_t *vma = vma_new((uintptr_t)addr, length, prot, flags, fd, offset);
-  vma_list_add_after(left, vma);
 
   void *ret = mmap(addr, length, prot, flags, fd, offset);
-  if (flags & MAP_FIXED) { assert(ret == addr); }
+  if (ret != MAP_FAILED) {
+    assert(ret == addr);
+    vma_free(old);
+    vma_root = vma_insert(vma_root, vma_new((uintptr_t)addr, length, prot, flags, fd, offset));
+  } else if (old != NULL) {
+    // the old mappings are kept by the host, so put their vmas back
+    vma_t *l, *r;
+    vma_split(vma_root, (uintptr_t)addr, &l, &r);
+    vma_root = vma_merge(vma_merge(l, old), r);
+  }
+  vma_unlock();
   return ret;
 }
 
 int user_munmap(void *addr, size_t length) {
-  vma_t *p = vma_list_find_fix_area((uintptr_t)addr, length);
-  assert(p != NULL);
-  vma_t *prev = p->prev;
-  vma_t *next = p->next;
-  prev->next = next;
-  next->prev = prev;
-
+  vma_lock();
+  vma_free(vma_extract((uintptr_t)addr, ROUNDUP(length, 4096)));
   int ret = munmap(addr, length);
   assert(ret == 0);
-  free(p);
+  vma_unlock();
+  return ret;
+}
+
+static void vma_set_prot(vma_t *t, int prot) {
+  if (t == NULL) return;
+  t->prot = prot;
+  vma_set_prot(t->left, prot);
+  vma_set_prot(t->right, prot);
+}
+
+int user_mprotect(void *addr, size_t length, int prot) {
+  vma_lock();
+  length = ROUNDUP(length, 4096);
+  int ret = mprotect(addr, length, prot);
+  if (ret == 0) {
+    vma_t *m = vma_extract((uintptr_t)addr, length);
+    vma_set_prot(m, prot);
+    // put the vmas back
+    vma_t *l, *r;
+    vma_split(vma_root, (uintptr_t)addr, &l, &r);
+    vma_root = vma_merge(vma_merge(l, m), r);
+  }
+  vma_unlock();
   return ret;
 }
 
 void *user_mremap(void *old_addr, size_t old_size, size_t new_size,
     int flags, void *new_addr) {
-  vma_t *p = vma_list_find_fix_area((uintptr_t)old_addr, old_size);
-  assert(p != NULL);
+  vma_lock();
+  old_size = ROUNDUP(old_size, 4096);
+  vma_root = vma_cut(vma_root, (uintptr_t)old_addr + old_size);
+  vma_t *p = vma_find((uintptr_t)old_addr);
+  assert(p != NULL && p->addr == (uintptr_t)old_addr && p->length == old_size);
   assert(!(flags & MREMAP_FIXED));
-  vma_t *next = p->next;
-  size_t free_size_to_expand = next->addr - p->addr;
+  size_t free_size_to_expand = vma_next_start(vma_end(p)) - p->addr;
   new_size = ROUNDUP(new_size, 4096);
   if (free_size_to_expand >= new_size) {
-    p->length = new_size;
     void *ret = mremap(old_addr, old_size, new_size, 0); // dont move
     if (ret != old_addr) perror("mremap");
     assert(ret == old_addr);
+    // the end of the vma is changed, so update the summaries on its path
+    vma_t *m = vma_extract(p->addr, p->length);
+    m->length = new_size;
+    vma_update(m);
+    vma_root = vma_insert(vma_root, m);
+    vma_unlock();
     return old_addr;
   } else {
     // should move
     new_addr = user_mmap(NULL, new_size, p->prot, p->flags & ~MAP_FIXED, -1, 0);
     memcpy(new_addr, old_addr, old_size);
-    user_munmap(old_addr, p->length);
+    user_munmap(old_addr, old_size);
+    vma_unlock();
     return new_addr;
   }
 }
@@ -30,8 +30,13 @@
 #define USER_SYS_fstat 80
 #define USER_SYS_exit 93
 #define USER_SYS_exit_group 94
+#define USER_SYS_set_tid_address 96
+#define USER_SYS_futex 98
+#define USER_SYS_set_robust_list 99
 #define USER_SYS_clock_gettime 113
+#define USER_SYS_sched_yield 124
 #define USER_SYS_rt_sigaction 134
+#define USER_SYS_rt_sigprocmask 135
 #define USER_SYS_times 153
 #define USER_SYS_uname 160
 #define USER_SYS_getrusage 165
@@ -41,13 +46,16 @@
 #define USER_SYS_geteuid 175
 #define USER_SYS_getgid 176
 #define USER_SYS_getegid 177
+#define USER_SYS_gettid 178
 #define USER_SYS_sysinfo 179
 #define USER_SYS_brk 214
 #define USER_SYS_munmap 215
 #define USER_SYS_mremap 216
+#define USER_SYS_clone 220
 #define USER_SYS_mmap 222
 #define USER_SYS_mprotect 226
 #define USER_SYS_prlimit64 261
+#define USER_SYS_clone3 435
 
 struct user_stat {
   uint64_t st_dev;
@@ -32,6 +32,8 @@
 #include <sys/uio.h>
 #include <sys/resource.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <sys/syscall.h>
 
 #include "user.h"
 #include MUXDEF(CONFIG_ISA_x86,     "syscall-x86.h", \
@@ -56,8 +58,11 @@ static inline uint64_t gen_uint64(uint32_t lo, uint32_t hi) {
 }
 #endif
 
+GUEST_THREAD_LOCAL word_t user_clear_child_tid = 0;
+
 static inline void user_sys_exit(int status) {
   void set_nemu_state(int state, vaddr_t pc, int halt_ret);
+  IFDEF(CONFIG_USER_THREADS, user_thread_end());
   set_nemu_state(NEMU_END, cpu.pc, status);
   longjmp_exec(NEMU_EXEC_END);
 }
@@ -93,7 +98,7 @@ static inline word_t user_sys_fstatat(int dirfd,
 
 static inline word_t user_gettimeofday(void *tv, void *tz) {
 #ifdef CONFIG_ISA64
-  return gettimeofday((struct timeval *) tv, (__timezone_ptr_t) tz);
+  return gettimeofday((struct timeval *) tv, (struct timezone *) tz);
 #else
   struct timeval host_tv;
   int ret = gettimeofday(&host_tv, tz);
@@ -258,8 +263,10 @@ uintptr_t host_syscall(uintptr_t id, uintptr_t arg1, uintptr_t arg2, uintptr_t a
 #endif
     IFDEF(CONFIG_ISA_x86, case USER_SYS_set_thread_area:
         ret = user_set_thread_area(user_to_host(arg1)); break);
-    case USER_SYS_exit_group:
-    case USER_SYS_exit: user_sys_exit(arg1); break;
+    case USER_SYS_exit:
+      IFDEF(CONFIG_USER_THREADS, user_thread_exit());
+      // fall through
+    case USER_SYS_exit_group: user_sys_exit(arg1); break;
     case USER_SYS_brk: ret = user_sys_brk(arg1); break;
     case USER_SYS_write: ret = write(user_fd(arg1), user_to_host(arg2), arg3); break;
     case USER_SYS_uname: ret = uname((struct utsname *) user_to_host(arg1)); break;
@@ -301,7 +308,19 @@ uintptr_t host_syscall(uintptr_t id, uintptr_t arg1, uintptr_t arg2, uintptr_t a
     case USER_SYS_ioctl: ret = ioctl(user_fd(arg1), arg2, arg3); break;
     case USER_SYS_fcntl: ret = fcntl(user_fd(arg1), arg2, arg3); break;
     case USER_SYS_getpid: return getpid();
-    case USER_SYS_mprotect: return 0; // not implemented
+    case USER_SYS_mprotect: ret = user_mprotect(user_to_host(arg1), arg2, arg3); break;
+    case USER_SYS_set_tid_address: user_clear_child_tid = arg1; return gettid();
+    case USER_SYS_gettid: return gettid();
+    case USER_SYS_futex: ret = syscall(SYS_futex, user_to_host(arg1), arg2, arg3,
+          user_to_host(arg4), user_to_host(arg5), arg6); break;
+    case USER_SYS_sched_yield: ret = sched_yield(); break;
+    case USER_SYS_set_robust_list: return 0; // not implemented
+    case USER_SYS_rt_sigprocmask: return 0; // not implemented
+#ifdef CONFIG_USER_THREADS
+    case USER_SYS_clone: return user_clone(arg1, arg2, arg3, arg4, arg5);
+    // not implemented, glibc falls back to clone()
+    case USER_SYS_clone3: return -ENOSYS;
+#endif
     case USER_SYS_ftruncate: ret = ftruncate(user_fd(arg1), arg2); break;
     case USER_SYS_faccessat: ret = faccessat(user_fd(arg1),
                                      (const char *)user_to_host(arg2), arg3, 0); break;
@@ -0,0 +1,176 @@
+/***************************************************************************************
+* Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Guest threads run in parallel on host threads.
+//
+// Every clone() creates a host thread, which starts with a copy of the CPU
+// state and CSRs of its parent, and has its own tcache and instruction
+// counter (see GUEST_THREAD_LOCAL). Guest memory is shared by nature since
+// guest addresses are host addresses, so futex() is forwarded to the host.
+//
+// exit() ends only the calling thread, and the last live thread calling it
+// ends the program. The thread calling exit_group() ends the program and
+// reports, the other threads stop when they see the end at their next batch,
+// and are killed by exit().
+
+#include "user.h"
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#ifdef CONFIG_USER_THREADS
+
+void isa_init_user_thread(const void *parent, word_t sp, bool set_tls, word_t tls);
+uint64_t get_abs_instr_count();
+int is_exit_status_bad();
+void simpoint_finish();
+extern GUEST_THREAD_LOCAL uint64_t g_nr_guest_instr;
+
+typedef struct {
+  void *parent;
+  uint64_t flags;
+  word_t sp, ptid, tls, ctid;
+  pid_t tid;
+  sem_t started;
+} CloneArgs;
+
+// instruction counters of the live threads, including the main thread
+typedef struct LiveThread {
+  uint64_t *nr_instr;
+  struct LiveThread *next;
+} LiveThread;
+
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static LiveThread *live_threads = NULL;
+static uint64_t exited_instr = 0;
+static bool ending = false;
+static __thread LiveThread self = {};
+static __thread bool is_ending = false;
+
+static void live_thread_add() {
+  self.nr_instr = &g_nr_guest_instr;
+  pthread_mutex_lock(&thread_lock);
+  self.next = live_threads;
+  live_threads = &self;
+  pthread_mutex_unlock(&thread_lock);
+}
+
+static inline uint64_t thread_instr_cnt() {
+  return MUXDEF(CONFIG_PERF_OPT, get_abs_instr_count(), g_nr_guest_instr);
+}
+
+// guest instructions of all threads, the live ones are counted up to their last batch
+uint64_t user_threads_instr_cnt() {
+  pthread_mutex_lock(&thread_lock);
+  uint64_t n = exited_instr;
+  for (LiveThread *t = live_threads; t != NULL; t = t->next) {
+    n += (t == &self ? thread_instr_cnt() : *t->nr_instr);
+  }
+  if (live_threads == NULL) n = thread_instr_cnt();
+  pthread_mutex_unlock(&thread_lock);
+  return n;
+}
+
+static void *thread_start(void *arg) {
+  CloneArgs *args = arg;
+  isa_init_user_thread(args->parent, args->sp, args->flags & CLONE_SETTLS, args->tls);
+
+  pid_t tid = gettid();
+  if (args->flags & CLONE_PARENT_SETTID) *(uint32_t *)user_to_host(args->ptid) = tid;
+  if (args->flags & CLONE_CHILD_SETTID) *(uint32_t *)user_to_host(args->ctid) = tid;
+  if (args->flags & CLONE_CHILD_CLEARTID) user_clear_child_tid = args->ctid;
+  live_thread_add();
+
+  // the arguments are freed by the parent after this
+  args->tid = tid;
+  sem_post(&args->started);
+
+  cpu_exec(-1);
+
+  // the program ends in this thread
+  simpoint_finish();
+  exit(is_exit_status_bad());
+}
+
+word_t user_clone(uint64_t flags, word_t sp, word_t ptid, word_t tls, word_t ctid) {
+  // only threads are supported, there is no fork()
+  if ((flags & (CLONE_VM | CLONE_THREAD)) != (CLONE_VM | CLONE_THREAD)) return -ENOSYS;
+
+  if (self.nr_instr == NULL) live_thread_add();
+
+  CloneArgs args = { .flags = flags, .sp = sp, .ptid = ptid, .tls = tls, .ctid = ctid };
+  args.parent = malloc(isa_snapshot_size());
+  assert(args.parent);
+  isa_snapshot_save(args.parent);
+  sem_init(&args.started, 0, 0);
+
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int ret = pthread_create(&thread, &attr, thread_start, &args);
+  Assert(ret == 0, "Can not create host thread for clone()");
+  pthread_attr_destroy(&attr);
+
+  sem_wait(&args.started);
+  sem_destroy(&args.started);
+  free(args.parent);
+  return args.tid;
+}
+
+static void clear_child_tid() {
+  if (user_clear_child_tid == 0) return;
+  uint32_t *tidptr = (uint32_t *)user_to_host(user_clear_child_tid);
+  __atomic_store_n(tidptr, 0, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, tidptr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// exit() of a thread, which returns only in the last live thread to end the program
+void user_thread_exit() {
+  uint64_t nr_instr = thread_instr_cnt();
+  pthread_mutex_lock(&thread_lock);
+  if (live_threads == NULL || (live_threads == &self && self.next == NULL)) {
+    pthread_mutex_unlock(&thread_lock);
+    return;
+  }
+  exited_instr += nr_instr;
+  LiveThread **p = &live_threads;
+  while (*p != &self) p = &(*p)->next;
+  *p = self.next;
+  pthread_mutex_unlock(&thread_lock);
+  Log("Thread %d exits after %'ld instructions", gettid(), nr_instr);
+
+  clear_child_tid();
+  pthread_exit(NULL);
+}
+
+// called when the program ends, by exit_group() or by a thread seeing the end,
+// only the first thread calling it reports and exits, the others wait to be killed
+void user_thread_end() {
+  pthread_mutex_lock(&thread_lock);
+  if (!ending) ending = is_ending = true;
+  pthread_mutex_unlock(&thread_lock);
+  if (is_ending) return;
+  while (true) pause();
+}
+
+#endif
@@ -39,9 +39,20 @@ extern user_state_t user_state;
 void *user_mmap(void *addr, size_t length, int prot,
     int flags, int fd, off_t offset);
 int user_munmap(void *addr, size_t length);
+int user_mprotect(void *addr, size_t length, int prot);
 void *user_mremap(void *old_addr, size_t old_size, size_t new_size,
     int flags, void *new_addr);
 
+// set by set_tid_address() and clone(), cleared and woken up when the thread exits
+extern GUEST_THREAD_LOCAL word_t user_clear_child_tid;
+
+#ifdef CONFIG_USER_THREADS
+word_t user_clone(uint64_t flags, word_t sp, word_t ptid, word_t tls, word_t ctid);
+void user_thread_exit();
+void user_thread_end();
+uint64_t user_threads_instr_cnt();
+#endif
+
 static inline uint8_t* user_to_host(word_t uaddr) {
   return (uint8_t *)(uintptr_t)uaddr;
 }
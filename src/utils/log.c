@@ -34,7 +34,7 @@ void init_log(const char *log_file, const bool small_log) {
 }
 
 bool log_enable() {
-  extern uint64_t g_nr_guest_instr;
+  extern GUEST_THREAD_LOCAL uint64_t g_nr_guest_instr;
   return (g_nr_guest_instr >= LOG_START) && (g_nr_guest_instr <= LOG_END);
 }
 
@@ -0,0 +1,142 @@
+#***************************************************************************************
+# Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+#!/usr/bin/env python3
+
+# Generate bare-metal RVV kernels, one per opcode class and SEW/LMUL.
+#
+# Every kernel sets vl to VLMAX, runs a loop whose body repeats the
+# instructions of its class, and ends with nemu_trap. The manifest lists
+# the kernels with the number of vector instructions they execute, which
+# is used by report.py to compute the throughput.
+
+import argparse
+import os
+
+BODY_LEN = 32
+
+# Register usage: v8 is the destination group, v16 and v24 are the source
+# groups, v1-v3 hold masks. The wide groups of widening and narrowing
+# instructions also start at v8 or v16, which is valid for LMUL <= 4.
+# a1/a2 point to the load and store buffers, a3 holds a scalar operand
+# and t2 the stride.
+#
+# Fixed-point instructions are not implemented yet, so there is no class
+# for them.
+
+def narrow_ok(sew, lmul):
+  return sew < 64 and lmul < 8
+
+CLASSES = {
+  'arith': ([
+    'vadd.vv v8, v16, v24', 'vsub.vx v8, v16, a3', 'vand.vi v8, v16, 5',
+    'vor.vv v8, v16, v24', 'vxor.vx v8, v16, a3', 'vsll.vi v8, v16, 3',
+    'vsra.vv v8, v16, v24', 'vminu.vv v8, v16, v24', 'vmax.vx v8, v16, a3',
+    'vadd.vv v8, v16, v24, v0.t', 'vmerge.vvm v8, v16, v24, v0', 'vmv.v.v v8, v16',
+  ], None),
+  'muldiv': ([
+    'vmul.vv v8, v16, v24', 'vmulh.vx v8, v16, a3', 'vmulhu.vv v8, v16, v24',
+    'vmacc.vv v8, v16, v24', 'vdivu.vv v8, v16, v24', 'vrem.vx v8, v16, a3',
+  ], None),
+  'widen': ([
+    'vwaddu.vv v8, v16, v24', 'vwadd.vx v8, v16, a3', 'vwsubu.wv v8, v8, v16',
+    'vwmul.vv v8, v16, v24', 'vwmulu.vx v8, v16, a3', 'vwmaccu.vv v8, v16, v24',
+  ], narrow_ok),
+  'narrow': ([
+    'vnsrl.wi v8, v16, 3', 'vnsra.wv v8, v16, v24', 'vnsrl.wx v8, v16, a3',
+    'vnsra.wi v8, v16, 1',
+  ], narrow_ok),
+  'reduce': ([
+    'vredsum.vs v8, v16, v24', 'vredmaxu.vs v8, v16, v24', 'vredxor.vs v8, v16, v24',
+    'vredmin.vs v8, v16, v24', 'vredand.vs v8, v16, v24, v0.t',
+  ], None),
+  'mask': ([
+    'vmseq.vv v1, v16, v24', 'vmsltu.vx v2, v16, a3', 'vmsgt.vi v3, v16, 4',
+    'vmand.mm v1, v2, v3', 'vmxor.mm v2, v1, v3', 'vmnor.mm v3, v1, v2',
+    'vcpop.m a4, v1', 'vfirst.m a5, v2', 'vid.v v8', 'viota.m v8, v3',
+  ], None),
+  'permute': ([
+    'vslideup.vi v8, v16, 3', 'vslidedown.vx v8, v16, a3', 'vslide1up.vx v8, v16, a3',
+    'vrgather.vv v8, v16, v24', 'vrgather.vi v8, v16, 1', 'vcompress.vm v8, v16, v1',
+    'vmv.x.s a4, v16', 'vmv.s.x v8, a3',
+  ], None),
+  'load': ([
+    'vle{sew}.v v8, (a1)', 'vle{sew}.v v16, (a1), v0.t', 'vlse{sew}.v v24, (a1), t2',
+  ], None),
+  'store': ([
+    'vse{sew}.v v8, (a2)', 'vse{sew}.v v16, (a2), v0.t', 'vsse{sew}.v v24, (a2), t2',
+  ], None),
+}
+
+PROLOGUE = '''  .text
+  .globl _start
+_start:
+  li t0, 0x600            # mstatus.VS = dirty
+  csrs mstatus, t0
+  li t1, 1024
+  vsetvli t0, t1, e8, m8, ta, mu
+  vid.v v16
+  vid.v v24
+  vadd.vi v24, v24, 1     # no zero divisors
+  vsetvli t0, t1, e8, m1, ta, mu
+  li t0, 0x55
+  vmv.v.x v0, t0
+  vmv.v.i v1, 0
+  vmv.v.i v2, 0
+  vmv.v.i v3, 0
+  li a1, 0x80100000
+  li a2, 0x80180000
+  li a3, 5
+  li t2, {stride}
+  vsetvli t0, t1, e{sew}, m{lmul}, ta, mu
+  li s1, {iters}
+1:
+'''
+
+EPILOGUE = '''  addi s1, s1, -1
+  bnez s1, 1b
+  li a0, 0
+  .word 0x0000006b        # nemu_trap
+'''
+
+def gen_kernel(cls, insts, sew, lmul, iters):
+  body = [insts[i % len(insts)].format(sew=sew) for i in range(BODY_LEN)]
+  return (PROLOGUE.format(sew=sew, lmul=lmul, iters=iters, stride=2 * sew // 8) +
+    ''.join('  %s\n' % i for i in body) + EPILOGUE)
+
+def main():
+  parser = argparse.ArgumentParser(description='Generate RVV microbenchmark kernels')
+  parser.add_argument('-o', '--output', default='build', help='output directory')
+  parser.add_argument('-n', '--iters', type=int, default=20000, help='loop iterations of each kernel')
+  parser.add_argument('-c', '--classes', default=','.join(CLASSES), help='comma-separated opcode classes')
+  args = parser.parse_args()
+
+  os.makedirs(args.output, exist_ok=True)
+  manifest = []
+  for cls in args.classes.split(','):
+    insts, ok = CLASSES[cls]
+    for sew in (8, 16, 32, 64):
+      for lmul in (1, 2, 4, 8):
+        if ok is not None and not ok(sew, lmul):
+          continue
+        name = '%s-e%d-m%d' % (cls, sew, lmul)
+        with open(os.path.join(args.output, name + '.s'), 'w') as f:
+          f.write(gen_kernel(cls, insts, sew, lmul, args.iters))
+        manifest.append('%s %s %d %d %d\n' % (name, cls, sew, lmul, BODY_LEN * args.iters))
+  with open(os.path.join(args.output, 'manifest'), 'w') as f:
+    f.writelines(manifest)
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,102 @@
+#***************************************************************************************
+# Copyright (c) 2020-2022 Institute of Computing Technology, Chinese Academy of Sciences
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+#!/usr/bin/env python3
+
+# Run the kernels listed in the manifest with NEMU and report the vector
+# instructions per host second of every kernel and every opcode class.
+#
+# The host time is the "host time spent" reported by NEMU, so that start-up
+# is not counted. With --csv the results are saved, and a saved file can be
+# passed with --baseline to show the speedup against it.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+from collections import OrderedDict
+
+def run_kernel(nemu, binary):
+  env = dict(os.environ, LC_ALL='C')
+  p = subprocess.run([nemu, '-b', binary], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, env=env)
+  log = p.stdout.decode(errors='replace')
+  if 'HIT GOOD TRAP' not in log:
+    return None
+  m = re.search(r'host time spent = ([\d,]+) us', log)
+  return int(m.group(1).replace(',', '')) if m else None
+
+def load_csv(path):
+  result = {}
+  with open(path) as f:
+    for line in f:
+      if line.startswith('#'):
+        continue
+      name, _, _, _, ninstr, us = line.strip().split(',')
+      result[name] = int(ninstr) / max(int(us), 1)
+  return result
+
+def main():
+  parser = argparse.ArgumentParser(description='Report RVV throughput of NEMU')
+  parser.add_argument('manifest', help='manifest written by gen.py')
+  parser.add_argument('--nemu', required=True, help='path to the NEMU interpreter')
+  parser.add_argument('--csv', help='save the results to this file')
+  parser.add_argument('--baseline', help='results saved by --csv to compare with')
+  args = parser.parse_args()
+
+  build_dir = os.path.dirname(args.manifest)
+  baseline = load_csv(args.baseline) if args.baseline else None
+  rows = []
+  classes = OrderedDict()
+  failed = 0
+
+  print('%-20s %12s %10s %10s%s' % ('kernel', 'vinstr', 'time(us)', 'MIPS', '   speedup' if baseline else ''))
+  with open(args.manifest) as f:
+    for line in f:
+      name, cls, sew, lmul, ninstr = line.split()
+      ninstr = int(ninstr)
+      us = run_kernel(args.nemu, os.path.join(build_dir, name + '.bin'))
+      if us is None:
+        print('%-20s %12s' % (name, 'FAILED'))
+        failed += 1
+        continue
+      us = max(us, 1)
+      mips = ninstr / us
+      speedup = ''
+      if baseline and name in baseline:
+        speedup = '%9.2fx' % (mips / baseline[name])
+      print('%-20s %12d %10d %10.2f %s' % (name, ninstr, us, mips, speedup))
+      rows.append((name, cls, sew, lmul, ninstr, us))
+      total = classes.setdefault(cls, [0, 0])
+      total[0] += ninstr
+      total[1] += us
+
+  print()
+  print('%-20s %12s %10s %10s' % ('class', 'vinstr', 'time(us)', 'MIPS'))
+  for cls, (ninstr, us) in classes.items():
+    print('%-20s %12d %10d %10.2f' % (cls, ninstr, us, ninstr / us))
+
+  if args.csv:
+    with open(args.csv, 'w') as f:
+      f.write('# kernel,class,sew,lmul,vinstr,us\n')
+      for r in rows:
+        f.write('%s,%s,%s,%s,%d,%d\n' % r)
+
+  if failed:
+    print('%d kernels failed, run them with NEMU to see the reason' % failed, file=sys.stderr)
+    sys.exit(1)
+
+if __name__ == '__main__':
+  main()